@@ -0,0 +1,246 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+// Microbenchmarks of the hot paths, over generated scenarios from 10^3 to 10^7 bodies. Loads simulation.cfg from the
+// working directory, or the path given by -s/--simulation, and runs in single precision whatever PRECISION is.
+// Pass --benchmark_format=json or --benchmark_out=<path> for machine-readable results to compare between versions.
+
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <numbers>
+#include <benchmark/benchmark.h>
+
+#include "BodyGenerator.hpp"
+#include "QuadTree.hpp"
+#include "Sim.hpp"
+
+enum class Scenario
+{
+	CirclePack, Galaxy, BinaryGalaxy
+};
+
+static const char* scenarioToString(const Scenario scenario)
+{
+	switch (scenario)
+	{
+	case Scenario::CirclePack:   return "CirclePack";
+	case Scenario::Galaxy:       return "Galaxy";
+	case Scenario::BinaryGalaxy: return "BinaryGalaxy";
+	}
+
+	return "Unknown"; // Unreachable.
+}
+
+// Distance between bodies hexagonally packed into the given area that fits about bodyCount of them.
+static float packDistance(const double area, const int64_t bodyCount)
+{
+	return static_cast<float>(std::sqrt(area / (std::numbers::sqrt3 / 2 * static_cast<double>(bodyCount))));
+}
+
+// Writes a generation file for about bodyCount bodies in the given scenario, returning its path.
+static std::string writeGenerationFile(const Scenario scenario, const int64_t bodyCount)
+{
+	static constexpr float CIRCLE_RADIUS = 2000;
+	static constexpr float GALAXY_OUTER_RADIUS = 500;
+	static constexpr float GALAXY_INNER_RADIUS = 200;
+	static constexpr double GALAXY_AREA = std::numbers::pi *
+		(GALAXY_OUTER_RADIUS * GALAXY_OUTER_RADIUS - GALAXY_INNER_RADIUS * GALAXY_INNER_RADIUS);
+
+	const std::filesystem::path path = std::filesystem::temp_directory_path() /
+		std::format("grav_sim_bench_{}_{}.cfg", scenarioToString(scenario), bodyCount);
+
+	std::ofstream file(path);
+	if (!file.is_open())
+		throw std::runtime_error(std::format("Failed to write generation file {}.", path.string()));
+
+	switch (scenario)
+	{
+	case Scenario::CirclePack:
+		file << std::format("CIRCLEPACK 0 0 0 0 {} {} 1 2\n", CIRCLE_RADIUS,
+			packDistance(std::numbers::pi * CIRCLE_RADIUS * CIRCLE_RADIUS, bodyCount));
+		break;
+	case Scenario::Galaxy:
+		file << std::format("GALAXY 0 0 0 0 {} {} {} 1e7 20 20 2 0\n", GALAXY_OUTER_RADIUS, GALAXY_INNER_RADIUS,
+			packDistance(GALAXY_AREA, bodyCount));
+		break;
+	case Scenario::BinaryGalaxy:
+		file << std::format("GALAXY  600 0 0  70 {} {} {} 1e7 20 20 2 0\n"
+			"GALAXY -600 0 0 -70 {} {} {} 1e7 20 20 2 0\n",
+			GALAXY_OUTER_RADIUS, GALAXY_INNER_RADIUS, packDistance(GALAXY_AREA, bodyCount / 2),
+			GALAXY_OUTER_RADIUS, GALAXY_INNER_RADIUS, packDistance(GALAXY_AREA, bodyCount / 2));
+		break;
+	}
+
+	return path.string();
+}
+
+struct Bodies
+{
+	std::string generationPath;
+	std::vector<glm::vec2> positions;
+	std::vector<glm::vec2> velocities;
+	std::vector<float> masses;
+	std::vector<float> diameters;
+};
+
+// Bodies of the scenario and body count given by the benchmark's arguments. Google Benchmark calls each benchmark
+// several times while picking an iteration count, so the last scenario is kept rather than regenerated.
+static const Bodies& scenarioBodies(const benchmark::State& state)
+{
+	static Scenario lastScenario;
+	static int64_t lastBodyCount = -1;
+	static Bodies bodies;
+
+	const auto scenario = static_cast<Scenario>(state.range(0));
+	const int64_t bodyCount = state.range(1);
+
+	if (scenario != lastScenario || bodyCount != lastBodyCount)
+	{
+		bodies = {};
+		bodies.generationPath = writeGenerationFile(scenario, bodyCount);
+		BodyGenerator::generateBodies(bodies.generationPath.c_str(), bodies.positions, bodies.velocities,
+			bodies.masses, bodies.diameters);
+
+		lastScenario = scenario;
+		lastBodyCount = bodyCount;
+	}
+
+	return bodies;
+}
+
+static void setCounters(benchmark::State& state, const size_t bodyCount)
+{
+	state.SetLabel(scenarioToString(static_cast<Scenario>(state.range(0))));
+	state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(bodyCount));
+	state.counters["bodies"] = static_cast<double>(bodyCount);
+}
+
+static void BM_GenerateBodies(benchmark::State& state)
+{
+	const Bodies& bodies = scenarioBodies(state);
+
+	for (auto _ : state)
+	{
+		std::vector<glm::vec2> positions;
+		std::vector<glm::vec2> velocities;
+		std::vector<float> masses;
+		std::vector<float> diameters;
+		BodyGenerator::generateBodies(bodies.generationPath.c_str(), positions, velocities, masses, diameters);
+		benchmark::DoNotOptimize(positions.data());
+	}
+
+	setCounters(state, bodies.positions.size());
+}
+
+static void BM_BuildTree(benchmark::State& state)
+{
+	const Bodies& bodies = scenarioBodies(state);
+	QuadTree<float> quadTree(bodies.positions, bodies.masses);
+
+	for (auto _ : state)
+	{
+		quadTree.buildTree();
+		benchmark::ClobberMemory();
+	}
+
+	setCounters(state, bodies.positions.size());
+}
+
+// Every body walking the tree on its own, i.e. QuadTree::accelAt over all bodies.
+static void BM_AccelAtAllBodies(benchmark::State& state)
+{
+	const Bodies& bodies = scenarioBodies(state);
+	QuadTree<float> quadTree(bodies.positions, bodies.masses);
+	quadTree.buildTree();
+
+	const ForceTraversal forceTraversal = g_forceTraversal;
+	g_forceTraversal = ForceTraversal::Body;
+
+	std::vector<glm::vec2> accelerations;
+	for (auto _ : state)
+	{
+		quadTree.computeAccelerations(accelerations);
+		benchmark::DoNotOptimize(accelerations.data());
+	}
+
+	g_forceTraversal = forceTraversal;
+	setCounters(state, bodies.positions.size());
+}
+
+// A whole step as configured by the simulation config: updating the tree, computing forces and integrating.
+static void BM_Step(benchmark::State& state)
+{
+	const Bodies& bodies = scenarioBodies(state);
+	Sim<float, float> sim(bodies.generationPath.c_str(), true);
+
+	for (auto _ : state)
+		sim.runHeadless(1);
+
+	setCounters(state, sim.getBodyCount());
+}
+
+// Every scenario at every power of ten from 10^3 to 10^7 bodies. The work is spread over threads, so wall time is what
+// matters.
+static void scenarioArgs(benchmark::internal::Benchmark* benchmark)
+{
+	benchmark->ArgNames({"scenario", "n"})
+		->ArgsProduct({
+			{static_cast<int64_t>(Scenario::CirclePack), static_cast<int64_t>(Scenario::Galaxy),
+				static_cast<int64_t>(Scenario::BinaryGalaxy)},
+			benchmark::CreateRange(1'000, 10'000'000, 10)})
+		->Unit(benchmark::kMillisecond)
+		->UseRealTime();
+}
+
+BENCHMARK(BM_GenerateBodies)->Apply(scenarioArgs);
+BENCHMARK(BM_BuildTree)->Apply(scenarioArgs);
+BENCHMARK(BM_AccelAtAllBodies)->Apply(scenarioArgs);
+BENCHMARK(BM_Step)->Apply(scenarioArgs);
+
+int main(int argc, char* argv[])
+{
+	benchmark::Initialize(&argc, argv);
+
+	const char* simulationPath = "simulation.cfg";
+
+	// Only options Google Benchmark didn't recognise are left.
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* option = argv[i];
+
+		if (strcmp(option, "-s") == 0 || strcmp(option, "--simulation") == 0)
+		{
+			if (++i >= argc)
+			{
+				std::cerr << "No argument supplied for simulation file.\n";
+				return 64;
+			}
+
+			simulationPath = argv[i];
+		}
+		else
+		{
+			std::cerr << "Unknown option '" << option << "'\n";
+			return 64;
+		}
+	}
+
+	try
+	{
+		loadSimulationFile(simulationPath);
+		benchmark::RunSpecifiedBenchmarks();
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << e.what();
+		return -1;
+	}
+
+	benchmark::Shutdown();
+	return 0;
+}
@@ -0,0 +1,43 @@
+import filecmp
+import os
+import subprocess
+import sys
+import tempfile
+
+# Checks a run restored from a checkpoint carries on exactly as the run that saved it would have. Runs 2N steps
+# straight through, then N steps and N more restored from a checkpoint of the first N, and compares the checkpoints
+# both end up saving.
+# Usage: python checkpoint-round-trip.py <grav_sim_cpu> <generation.cfg> <simulation.cfg> [N]
+
+def run(executable, *args):
+    subprocess.run([executable, "--headless", *args], check=True, stdout=subprocess.DEVNULL)
+
+def main():
+    if len(sys.argv) < 4:
+        print("Usage: python checkpoint-round-trip.py <grav_sim_cpu> <generation.cfg> <simulation.cfg> [N]")
+        return 64
+
+    executable, generation, simulation = (os.path.abspath(path) for path in sys.argv[1:4])
+    steps = int(sys.argv[4]) if len(sys.argv) > 4 else 10
+
+    with tempfile.TemporaryDirectory() as directory:
+        straight = os.path.join(directory, "straight.bin")
+        halfway = os.path.join(directory, "halfway.bin")
+        restored = os.path.join(directory, "restored.bin")
+
+        run(executable, "-n", str(2 * steps), "-g", generation, "-s", simulation,
+            "--checkpoint", straight, "--checkpoint-interval", str(2 * steps))
+        run(executable, "-n", str(steps), "-g", generation, "-s", simulation,
+            "--checkpoint", halfway, "--checkpoint-interval", str(steps))
+        run(executable, "-n", str(steps), "-r", halfway,
+            "--checkpoint", restored, "--checkpoint-interval", str(steps))
+
+        if not filecmp.cmp(straight, restored, shallow=False):
+            print(f"Restored run differs from the straight run after {2 * steps} steps.")
+            return 1
+
+    print(f"Restored run matches the straight run after {2 * steps} steps.")
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
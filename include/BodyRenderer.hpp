@@ -0,0 +1,50 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#ifndef GRAV_SIM_CPU_BODY_RENDERER_HPP
+#define GRAV_SIM_CPU_BODY_RENDERER_HPP
+
+#include <vector>
+#include <glm/vec2.hpp>
+#include <raylib.h>
+
+// A body as drawn, packed into 16 bytes so the whole array is uploaded as the instance buffer.
+struct BodyInstance
+{
+	glm::vec2 position;
+	float diameter;
+	Color color;
+};
+
+static_assert(sizeof(BodyInstance) == 16);
+
+// Draws every body in a single instanced draw call, as a quad of the body texture stretched over the body's diameter
+// and tinted its color. Needs OpenGL 3.3, which Raylib uses on desktop by default.
+class BodyRenderer
+{
+public:
+	// Compiles the shader and creates the vertex buffers. To be called once the window is open.
+	void load(Texture2D texture);
+
+	// Uploads the bodies to draw, growing the instance buffer if there are more than it holds.
+	void setInstances(const std::vector<BodyInstance>& instances);
+	// Draws the bodies last uploaded through the current camera, after anything already drawn this frame.
+	void draw() const;
+
+private:
+	Texture2D m_texture = {};
+	Shader m_shader = {};
+	int m_mvpLocation = -1;
+	int m_textureLocation = -1;
+
+	unsigned int m_vertexArray = 0;
+	unsigned int m_quadBuffer = 0;
+	unsigned int m_instanceBuffer = 0;
+	size_t m_instanceCapacity = 0;
+	size_t m_instanceCount = 0;
+
+	void loadInstanceBuffer(size_t capacity);
+};
+
+#endif //GRAV_SIM_CPU_BODY_RENDERER_HPP
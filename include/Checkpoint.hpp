@@ -0,0 +1,160 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#ifndef GRAV_SIM_CPU_CHECKPOINT_HPP
+#define GRAV_SIM_CPU_CHECKPOINT_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "common.hpp"
+
+// Checkpoints are a header, the simulation parameters as config file text, and then a column per body array and per
+// quadtree array, each aligned to CHECKPOINT_ALIGNMENT. They're written in the machine's byte order, which the header
+// records, so restoring is mapping the file and copying the columns out. The quadtree is saved as well as the bodies so
+// a restored run refits the same tree the saving run would have, and continues exactly as it would have.
+
+constexpr uint32_t CHECKPOINT_VERSION = 2;
+constexpr size_t CHECKPOINT_ALIGNMENT = 64;
+
+enum class CheckpointColumn
+{
+	Positions, Velocities, Masses, Diameters, BodyIds, TimestepLevels,
+	TreeIndices, TreeNodes, TreeNodeBodyRanges, TreeNodeCells
+};
+
+constexpr int CHECKPOINT_COLUMN_COUNT = static_cast<int>(CheckpointColumn::TreeNodeCells) + 1;
+
+// Everything saved besides the parameters and columns.
+struct CheckpointState
+{
+	uint64_t step;
+	double time;
+	// Steps since the quadtree was last rebuilt.
+	uint32_t stepsSinceRebuild;
+	// The Integrator, BLOCKTIMESTEPLEVELS and delta time velocities were kicked ahead for.
+	uint32_t integrator;
+	uint32_t blockTimestepLevels;
+	uint32_t padding;
+	double deltaTime;
+	// What the quadtree's positions are relative to in MIXED precision.
+	std::array<double, 2> origin;
+};
+
+struct CheckpointHeader
+{
+	std::array<char, 8> magic;
+	uint32_t version;
+	// Reads back as a different value on machines of the other byte order.
+	uint32_t byteOrderMark;
+	uint64_t bodyCount;
+	CheckpointState state;
+
+	uint64_t parametersOffset;
+	uint64_t parametersSize;
+
+	struct Column
+	{
+		uint64_t offset;
+		uint64_t count;
+		uint32_t elementSize;
+		uint32_t padding;
+	};
+
+	std::array<Column, CHECKPOINT_COLUMN_COUNT> columns;
+};
+
+// An array to write to a checkpoint.
+struct CheckpointColumnData
+{
+	const void* data;
+	uint64_t count;
+	uint32_t elementSize;
+};
+
+// Writes a checkpoint of bodyCount bodies to path. The file is written under a temporary name and then renamed over
+// path, so an interrupted save never leaves a broken checkpoint behind.
+void writeCheckpoint(const char* path, uint64_t bodyCount, const CheckpointState& state, const std::string& parameters,
+	const std::array<CheckpointColumnData, CHECKPOINT_COLUMN_COUNT>& columns);
+
+// A checkpoint file mapped into memory, which stays mapped until destruction.
+class Checkpoint
+{
+public:
+	explicit Checkpoint(const char* path);
+	~Checkpoint();
+
+	Checkpoint(const Checkpoint&) = delete;
+	Checkpoint& operator=(const Checkpoint&) = delete;
+
+	[[nodiscard]] uint64_t getBodyCount() const;
+	[[nodiscard]] const CheckpointState& getState() const;
+	[[nodiscard]] uint32_t getElementSize(CheckpointColumn column) const;
+	// Replaces the simulation parameters with the ones saved in the checkpoint.
+	void loadParameters() const;
+
+	// Copies a column out into values. Columns of floats or vectors of them are converted if they were saved in the
+	// other precision.
+	template <typename T>
+	void readColumn(CheckpointColumn column, std::vector<T>& values) const;
+
+private:
+	std::string m_path;
+	const std::byte* m_data = nullptr;
+	size_t m_size = 0;
+	// Holds the file when it can't be mapped.
+	std::vector<std::byte> m_buffer;
+
+	void unmap();
+	[[nodiscard]] const CheckpointHeader& header() const;
+};
+
+template <typename T>
+struct OtherPrecision { using Type = void; };
+template <>
+struct OtherPrecision<float> { using Type = double; };
+template <>
+struct OtherPrecision<double> { using Type = float; };
+template <typename Real>
+struct OtherPrecision<Vec2_t<Real>> { using Type = Vec2_t<typename OtherPrecision<Real>::Type>; };
+
+template <typename T>
+void Checkpoint::readColumn(const CheckpointColumn column, std::vector<T>& values) const
+{
+	const CheckpointHeader::Column& entry = header().columns[static_cast<int>(column)];
+	const size_t count = entry.count;
+	const std::byte* source = m_data + entry.offset;
+
+	values.resize(count);
+
+	if (entry.elementSize == sizeof(T))
+	{
+		std::memcpy(values.data(), source, count * sizeof(T));
+		return;
+	}
+
+	using Other = typename OtherPrecision<T>::Type;
+	if constexpr (!std::is_void_v<Other>)
+	{
+		if (entry.elementSize == sizeof(Other))
+		{
+			std::vector<Other> saved(count);
+			std::memcpy(saved.data(), source, count * sizeof(Other));
+			std::ranges::transform(saved, values.begin(), [](const Other value) { return static_cast<T>(value); });
+			return;
+		}
+	}
+
+	throw std::runtime_error(std::format("Checkpoint {} has a column of {} byte elements where {} were expected.",
+		m_path, entry.elementSize, sizeof(T)));
+}
+
+#endif //GRAV_SIM_CPU_CHECKPOINT_HPP
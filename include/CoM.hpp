@@ -6,10 +6,17 @@
 #define GRAV_SIM_CPU_COM_HPP
 #include "common.hpp"
 
+template <typename Real>
 struct CoM
 {
-	glm::vec2 position = {};
-	float mass = 0;
+	Vec2_t<Real> position = {};
+	Real mass = 0;
+
+	// Second moments of mass about position, sum of mass * offset_i * offset_j. Gravity in the plane isn't harmonic, so
+	// unlike in 3D the trace doesn't drop out and the full tensor is kept.
+	Real momentXX = 0;
+	Real momentXY = 0;
+	Real momentYY = 0;
 };
 
 #endif //GRAV_SIM_CPU_COM_HPP
\ No newline at end of file
@@ -0,0 +1,33 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#ifndef GRAV_SIM_CPU_DIRECT_SOLVER_HPP
+#define GRAV_SIM_CPU_DIRECT_SOLVER_HPP
+
+#include <vector>
+
+#include "common.hpp"
+#include "gravityKernels.hpp"
+
+// Sums the gravity of every body on every other directly. O(N^2), but without any of the tree's overhead, so it's
+// faster for small systems, and exact up to rounding, so it's a reference for the tree's accuracy.
+template <typename Real>
+class DirectSolver
+{
+public:
+	DirectSolver(const std::vector<Vec2_t<Real>>& positions, const std::vector<Real>& masses);
+
+	// Acceleration of every body, indexed the same as positions. If active is given, only bodies it's nonzero for are
+	// computed, and the rest are left as they were.
+	void computeAccelerations(std::vector<Vec2_t<Real>>& accelerations, const std::vector<uint8_t>* active = nullptr);
+
+private:
+	const std::vector<Vec2_t<Real>>* m_positions;
+	const std::vector<Real>* m_masses;
+
+	// The bodies as structures of arrays for the kernels, refilled on every computeAccelerations.
+	BodySources<Real> m_sources;
+};
+
+#endif //GRAV_SIM_CPU_DIRECT_SOLVER_HPP
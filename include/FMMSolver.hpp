@@ -0,0 +1,73 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#ifndef GRAV_SIM_CPU_FMM_SOLVER_HPP
+#define GRAV_SIM_CPU_FMM_SOLVER_HPP
+
+#include <array>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "QuadTree.hpp"
+
+// Fast multipole method over the nodes of a QuadTree. Each node gets a multipole expansion of its bodies and a local
+// expansion of the field from distant nodes, both Cartesian Taylor expansions up to FMMORDER about the node's CoM.
+// Expansions are of the softened potential whose gradient is gravAccel, so far and near interactions agree. They're
+// always in double, whatever precision the tree's bodies are in.
+template <typename Real>
+class FMMSolver
+{
+public:
+	explicit FMMSolver(const QuadTree<Real>& quadTree);
+
+	// Acceleration of every body, indexed the same as the tree's positions. If active is given, only bodies it's nonzero
+	// for are written. The upward pass still covers every body, but subtrees without active bodies are skipped.
+	void computeAccelerations(std::vector<Vec2_t<Real>>& accelerations, const std::vector<uint8_t>* active = nullptr);
+
+private:
+	static constexpr int MAX_COEFF_COUNT = (MAX_FMM_ORDER + 1) * (MAX_FMM_ORDER + 2) / 2;
+	using Coeffs_t = std::array<double, MAX_COEFF_COUNT>;
+
+	const QuadTree<Real>* m_quadTree;
+	// Read from the globals at the start of each computeAccelerations. The FMM's opening criterion compares radii
+	// rather than sizes, so it has its own FMMTHETA in place of the tree walks' THETA.
+	ForceParams<Real> m_params = {};
+	double m_sqrTheta = 0;
+
+	int m_order = 0;
+	int m_coeffCount = 0;
+	// Coefficients of each node, m_coeffCount per node, indexed by coeffIndex.
+	std::vector<double> m_multipoles;
+	std::vector<double> m_locals;
+	// Distance from each node's CoM to its furthest body.
+	std::vector<double> m_radii;
+	// Accelerations in tree order.
+	std::vector<Vec2_t<Real>> m_bodyAccels;
+	// Nodes whose subtrees are evaluated as independent tasks.
+	std::vector<NodeIndex_t> m_taskNodes;
+
+	void setOrder(int order);
+
+	void collectTaskNodes();
+	// Whether a node is a leaf to the FMM, which doesn't split nodes with few bodies even where the tree does.
+	[[nodiscard]] bool isLeaf(NodeIndex_t nodeIndex) const;
+
+	void upwardPass(NodeIndex_t nodeIndex, int depth);
+	void interact(NodeIndex_t target, NodeIndex_t source);
+	void downwardPass(NodeIndex_t nodeIndex);
+
+	void particlesToMultipole(NodeIndex_t nodeIndex);
+	void multipoleToMultipole(NodeIndex_t child, NodeIndex_t parent);
+	void multipoleToLocal(NodeIndex_t source, NodeIndex_t target);
+	void localToLocal(NodeIndex_t parent, NodeIndex_t child);
+	void localToParticles(NodeIndex_t nodeIndex);
+	void particlesToParticles(NodeIndex_t source, NodeIndex_t target);
+
+	// Derivatives of the kernel at rel up to m_order, indexed by coeffIndex.
+	void kernelDerivatives(glm::dvec2 rel, Coeffs_t& derivatives) const;
+	// rel^k / k! for each multi-index k up to order, indexed by coeffIndex.
+	static void scaledPowers(glm::dvec2 rel, int order, Coeffs_t& powers);
+};
+
+#endif //GRAV_SIM_CPU_FMM_SOLVER_HPP
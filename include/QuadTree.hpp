@@ -4,61 +4,192 @@
 
 #ifndef GRAV_SIM_CPU_QUAD_TREE_HPP
 #define GRAV_SIM_CPU_QUAD_TREE_HPP
+#include <array>
+#include <atomic>
 #include <vector>
-#include <glm/vec2.hpp>
+#include <glm/glm.hpp>
 
+#include "Checkpoint.hpp"
 #include "CoM.hpp"
 #include "common.hpp"
+#include "gravityKernels.hpp"
 #include "parameters.hpp"
 
 using NodeIndex_t = uint32_t;
 static constexpr NodeIndex_t NULL_INDEX = -1;
 
+// A node's cell as drawn by the quadtree visualization.
+struct QuadTreeCell
+{
+	glm::vec2 center;
+	float size;
+	bool leaf;
+};
+
+// Stores and walks bodies in Real, the force precision selected by PRECISION.
+template <typename Real>
 class QuadTree
 {
 public:
-	QuadTree(const std::vector<glm::vec2>& positions, const std::vector<float>& masses);
+	QuadTree(const std::vector<Vec2_t<Real>>& positions, const std::vector<Real>& masses);
 
 	void buildTree();
+	// Rebuilds the tree every TREEREBUILDINTERVAL steps or once a refit degrades it too far, otherwise refits it.
+	// Returns whether the tree was rebuilt.
+	bool updateTree();
+	// Whether the next updateTree is due to rebuild whatever the bodies do.
+	[[nodiscard]] bool rebuildDue() const;
+	// To be called once the body arrays have been permuted into the order given by getIndices(), which becomes the
+	// identity.
+	void onBodiesReordered();
 
 	[[nodiscard]] const std::vector<BodyIndex_t>& getIndices() const;
-	[[nodiscard]] glm::vec2 getSystemCoMPosition() const;
 
-	[[nodiscard]] glm::vec2 accelAt(glm::vec2 position) const;
+	// Fills in the checkpoint columns from TreeIndices on with the tree.
+	void getCheckpointColumns(std::array<CheckpointColumnData, CHECKPOINT_COLUMN_COUNT>& columns) const;
+	[[nodiscard]] uint32_t getStepsSinceRebuild() const;
+	// Replaces the tree with the one saved to checkpoint, over the bodies as they are now, so it's refitted and rebuilt
+	// on the same steps as it would have been. Returns false, leaving the tree to be built, if it was saved in the other
+	// precision.
+	bool restore(const Checkpoint& checkpoint);
+
+	[[nodiscard]] Vec2_t<Real> getSystemCoMPosition() const;
 
-	void visualize(float cameraZoom) const;
+	// Acceleration of every body, indexed the same as positions, using the walk selected by FORCETRAVERSAL. If active
+	// is given, only bodies it's nonzero for are computed, and the rest are left as they were.
+	void computeAccelerations(std::vector<Vec2_t<Real>>& accelerations,
+		const std::vector<uint8_t>* active = nullptr) const;
+
+	// Fills cells with every node's cell, parents before their children, to be drawn by visualize.
+	void collectCells(std::vector<QuadTreeCell>& cells) const;
+	static void visualize(const std::vector<QuadTreeCell>& cells, float cameraZoom);
 
 private:
-	struct Node
+	// Walks the same nodes to evaluate its expansions.
+	template <typename>
+	friend class FMMSolver;
+
+	// Range of a node's bodies in tree order, i.e. in m_indices, m_bodyXs, m_bodyYs and m_bodyMasses.
+	struct BodyRange
 	{
-		NodeIndex_t child1 = NULL_INDEX;
-		NodeIndex_t child2 = NULL_INDEX;
-		NodeIndex_t child3 = NULL_INDEX;
-		NodeIndex_t child4 = NULL_INDEX;
+		BodyIndex_t first = 0;
+		BodyIndex_t count = 0;
 	};
 
-	std::vector<BodyIndex_t> m_indices;
-	const std::vector<glm::vec2>* m_positions;
-	const std::vector<float>* m_masses;
+	// A node as written by the builders, indexed in the order nodes were claimed from m_buildNodes. Laid out
+	// depth-first once built.
+	struct BuildNode
+	{
+		std::array<NodeIndex_t, 4> children = {NULL_INDEX, NULL_INDEX, NULL_INDEX, NULL_INDEX};
+		CoM<Real> com;
+		BodyRange bodies;
+		Vec2_t<Real> cellCenter = {};
+		Real cellSize = 0;
+		NodeIndex_t subtreeSize = 0;
+		bool isLeaf = false;
+	};
+
+	// Everything a tree walk reads to accept or skip a node, packed so a visit is a single cache line: 32 bytes in
+	// float, 64 in double.
+	struct alignas(8 * sizeof(Real)) Node
+	{
+		CoM<Real> com;
+		// Square of the size used by the opening criterion. The cell size after a rebuild, but may grow when refitted.
+		Real sqrSize = 0;
+		NodeIndex_t skip = 0;
+	};
+	static_assert(sizeof(Node) == 8 * sizeof(Real));
+
+	struct NodeCell
+	{
+		Vec2_t<Real> center = {};
+		Real size = 0;
+	};
 
+	struct Bounds
+	{
+		Vec2_t<Real> min = {INFINITY, INFINITY};
+		Vec2_t<Real> max = {-INFINITY, -INFINITY};
+
+		[[nodiscard]] Bounds merge(const Bounds& other) const
+		{
+			return {glm::min(min, other.min), glm::max(max, other.max)};
+		}
+	};
+
+	struct RefitResult
+	{
+		Bounds bounds;
+		// Sum over the refitted nodes of the ratio of their size to their original cell size, weighted by their body
+		// counts, and the sum of those weights. Their ratio is how much larger the average body's nodes have grown.
+		double weightedGrowth = 0;
+		double weight = 0;
+	};
+
+	std::vector<BodyIndex_t> m_indices;
+	std::vector<uint32_t> m_mortonKeys;
+	std::vector<uint32_t> m_mortonKeysScratch;
+	std::vector<BodyIndex_t> m_indicesScratch;
+	const std::vector<Vec2_t<Real>>* m_positions;
+	const std::vector<Real>* m_masses;
+
+	// Copies of the bodies in tree order, so each leaf's bodies are contiguous. Split by component for the kernels.
+	std::vector<Real> m_bodyXs;
+	std::vector<Real> m_bodyYs;
+	std::vector<Real> m_bodyMasses;
+
+	// Arena the builders claim nodes from. Kept between builds, and grown when a build runs out of room.
+	std::vector<BuildNode> m_buildNodes;
+
+	// Nodes in depth-first order. A node's first child directly follows it, and its skip index is the node after its
+	// subtree. Split by how often the tree walks touch them: every visited node reads its Node, only opened leaves read
+	// their BodyRange, and only refits and visualization read their NodeCell.
 	std::vector<Node> m_nodes;
-	std::vector<CoM> m_nodeCoMs;
-	std::vector<BodyIndex_t> m_nodeBodyIndices;
-	std::vector<uint8_t> m_nodeIsLeaf;
+	std::vector<BodyRange> m_nodeBodyRanges;
+	std::vector<NodeCell> m_nodeCells;
+
+	// Nodes whose bodies share one interaction list when walking the tree by group: the topmost nodes with at most
+	// GROUPSIZE bodies, or leaves.
+	std::vector<NodeIndex_t> m_groupNodes;
+
+	std::atomic<NodeIndex_t> m_nodeCounter = 0;
+	int m_stepsSinceRebuild = 0;
+	Real m_boundsSize = 0;
+	Vec2_t<Real> m_boundsCenter = {};
+
+	// A node without children is directly followed by the next node after it, so leaves need no flag.
+	[[nodiscard]] bool isLeaf(const NodeIndex_t nodeIndex) const { return m_nodes[nodeIndex].skip == nodeIndex + 1; }
 
-	std::vector<float> m_precomputedBoundsSizes;
+	// Instantiated once per ForceLaw, so the walk has no branches or global reads for the force law.
+	template <typename Law>
+	[[nodiscard]] Vec2_t<Real> accelAt(Vec2_t<Real> position, ForceParams<Real> params) const;
 
-	NodeIndex_t m_nodeCounter = 0;
-	float m_boundsSize = 0;
-	glm::vec2 m_boundsCenter = {};
+	void collectGroups();
+	void accelerationsForGroup(NodeIndex_t groupNode, ForceParams<Real> params, const std::vector<uint8_t>* active,
+		NodeSources<Real>& sourceNodes, BodySources<Real>& sourceBodies, std::vector<Vec2_t<Real>>& accelerations) const;
 
 	void calculateBoundingSquare();
 
-	NodeIndex_t buildTree(IndexIt_t begin, IndexIt_t end, float size, glm::vec2 center);
+	void sortByMortonKey();
+
+	RefitResult refitTree(NodeIndex_t nodeIndex, int depth);
+
+	// Builds from the root with the builder selected by TREEBUILDER, returning NULL_INDEX if there are no bodies.
+	NodeIndex_t buildRoot();
+	NodeIndex_t buildTree(IndexIt_t begin, IndexIt_t end, Real size, Vec2_t<Real> center, int depth);
+	NodeIndex_t buildTreeMorton(IndexIt_t begin, IndexIt_t end, Real size, Vec2_t<Real> center, int level);
+
+	// Returns NULL_INDEX if the arena is full.
+	NodeIndex_t createNode(IndexIt_t begin, IndexIt_t end, Real size, Vec2_t<Real> center, int depth);
+	[[nodiscard]] Vec2_t<Real> bodyPosition(const BodyIndex_t i) const { return {m_bodyXs[i], m_bodyYs[i]}; }
 
-	[[nodiscard]] glm::vec2 accelAt(glm::vec2 position, NodeIndex_t nodeIndex, int depth) const;
+	// Copies a leaf's bodies into tree order and calculates its CoM.
+	Bounds gatherLeaf(BodyRange bodies, CoM<Real>& com);
+	template <typename BuildFunc>
+	void buildChildren(NodeIndex_t nodeIndex, const std::array<IndexIt_t, 5>& splits, Real size, Vec2_t<Real> center,
+		BuildFunc buildChild);
 
-	void visualize(NodeIndex_t nodeIndex, Rectangle rect, float cameraZoom) const;
+	void layoutDepthFirst(NodeIndex_t buildIndex, NodeIndex_t nodeIndex);
 };
 
 #endif //GRAV_SIM_CPU_QUAD_TREE_HPP
\ No newline at end of file
@@ -5,44 +5,208 @@
 #ifndef GRAV_SIM_CPU_SIM_HPP
 #define GRAV_SIM_CPU_SIM_HPP
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 #include <glm/vec2.hpp>
 
+#include "BodyRenderer.hpp"
+#include "Checkpoint.hpp"
+#include "DirectSolver.hpp"
+#include "FMMSolver.hpp"
 #include "parameters.hpp"
 #include "QuadTree.hpp"
+#include "TrajectoryWriter.hpp"
 
+static constexpr const char* DEFAULT_CHECKPOINT_PATH = "checkpoint.bin";
+
+// Stores and integrates the bodies in StorageReal, and computes the forces on them in ForceReal. See PRECISION.
+template <typename StorageReal, typename ForceReal>
 class Sim
 {
 public:
-	Sim(const char* generationPath);
+	// Generates the bodies from the generation file. Opens the window unless headless, in which case only runHeadless
+	// may be used.
+	explicit Sim(const char* generationPath, bool headless = false);
+	// Restores the bodies and step from a checkpoint, whose parameters should already have been loaded. If they've been
+	// overridden with a different integrator, BLOCKTIMESTEPLEVELS or delta time, velocities are kicked ahead again to
+	// suit them.
+	explicit Sim(const Checkpoint& checkpoint, bool headless = false);
+	// Stops the stepping thread, waiting out the step it's on.
+	~Sim();
+
+	Sim(const Sim&) = delete;
+	Sim& operator=(const Sim&) = delete;
 
+	// Steps on a separate thread while the window draws the latest completed step, so slow steps don't stall the
+	// window.
 	void run();
+	// Steps the given number of times as fast as possible, without a window or frame rate limit.
+	void runHeadless(uint64_t steps);
+
+	[[nodiscard]] size_t getBodyCount() const;
+
+	// Where checkpoints are saved, and how many steps between saving them automatically. An interval of 0 only saves
+	// them when asked to.
+	void setCheckpointing(const char* path, uint64_t interval);
+	void saveCheckpoint() const;
+	// Starts writing a trajectory frame every TRAJECTORYINTERVAL steps to path, beginning with the current step.
+	void setTrajectoryOutput(const char* path);
 
 private:
-	std::vector<glm::vec2> m_positions = {};
-	std::vector<glm::vec2> m_velocities = {};
-	std::vector<float> m_masses = {};
+	// Forces are computed from positions converted to ForceReal relative to m_origin, rather than from m_positions.
+	static constexpr bool MIXED_PRECISION = !std::is_same_v<StorageReal, ForceReal>;
+
+	std::vector<Vec2_t<StorageReal>> m_positions = {};
+	std::vector<Vec2_t<StorageReal>> m_velocities = {};
+	std::vector<ForceReal> m_masses = {};
 	std::vector<float> m_diameters = {};
+	std::vector<Vec2_t<ForceReal>> m_accelerations = {};
+	// Generation order index of each body, which stays the same when the body arrays are reordered.
+	std::vector<BodyIndex_t> m_bodyIds = {};
+	// Block timestep level of each body, which steps by the frame's delta time over 2^level.
+	std::vector<uint8_t> m_timestepLevels = {};
+	// Whether each body is due a force evaluation on the current sub-step.
+	std::vector<uint8_t> m_activeBodies = {};
+
+	// Positions the tree is built over when MIXED_PRECISION. Kept close to the bodies so converting to ForceReal
+	// loses as little as possible, and only moved when the tree is rebuilt.
+	std::vector<Vec2_t<ForceReal>> m_treePositions = {};
+	Vec2_t<StorageReal> m_origin = {};
 
-	QuadTree m_quadTree;
+	// Each body of the front snapshot as drawn, and the step and colormap mode it was last filled for.
+	std::vector<BodyInstance> m_bodyInstances = {};
+	std::optional<uint64_t> m_bodyInstancesStep;
+	ColormapMode m_bodyInstancesColormapMode = ColormapMode::None;
+
+	QuadTree<ForceReal> m_quadTree;
+	FMMSolver<ForceReal> m_fmmSolver;
+	DirectSolver<ForceReal> m_directSolver;
 
 	Texture2D m_circleTex;
+	BodyRenderer m_bodyRenderer;
 	Camera2D m_camera;
 
+	// Steps taken and simulated time passed since the bodies were generated, carried over by checkpoints. Time goes
+	// back while it's reversed.
+	uint64_t m_step = 0;
+	double m_time = 0;
+	std::string m_checkpointPath = DEFAULT_CHECKPOINT_PATH;
+	uint64_t m_checkpointInterval = 0;
+	std::unique_ptr<TrajectoryWriter<StorageReal>> m_trajectoryWriter;
+
+	// What's drawn of a completed step, so drawing never reads the bodies mid-step.
+	struct Snapshot
+	{
+		std::vector<glm::vec2> positions;
+		std::vector<glm::vec2> velocities;
+		std::vector<float> diameters;
+		// Only filled when visualizing the quadtree.
+		std::vector<QuadTreeCell> treeCells;
+		uint64_t step = 0;
+		Solver solver = Solver::BarnesHut;
+	};
+
+	// The front snapshot is drawn while the stepping thread fills the other. They're swapped between steps.
+	std::array<Snapshot, 2> m_snapshots;
+	int m_frontSnapshot = 0;
+	bool m_snapshotTreeCells = false;
+
+	// Input that changes what the stepping thread reads, held until it's between steps.
+	struct PendingInput
+	{
+		// Times to double (or halve if negative) the timescale.
+		int timeScaleDoublings = 0;
+		bool toggleTimeReverse = false;
+		bool focusCoM = false;
+		bool saveCheckpoint = false;
+	};
+
+	PendingInput m_pendingInput;
+
+	std::thread m_stepThread;
+	std::mutex m_stepMutex;
+	std::condition_variable m_stepRequested;
+	bool m_stepPending = false;
+	bool m_stopStepping = false;
+	// Set from requesting a step until its snapshot is filled. The bodies and snapshots are only touched from the main
+	// thread while it's clear.
+	std::atomic<bool> m_stepRunning = false;
+	bool m_stepCompleted = false;
+	std::exception_ptr m_stepError;
+
 	bool m_paused = false;
 	bool m_visualizeQuadTree = false;
 	bool m_showDetails = false;
 	bool m_timeReverse = false;
 	bool m_showControls = false;
 
+	// The positions the tree and solvers read, m_positions itself unless MIXED_PRECISION.
+	[[nodiscard]] const std::vector<Vec2_t<ForceReal>>& treePositions() const;
+	// Converts m_positions into m_treePositions when MIXED_PRECISION, first moving m_origin to the bodies' CoM if the
+	// tree is due a rebuild. To be called before every tree update.
+	void syncTreePositions();
+	void convertTreePositions();
+	[[nodiscard]] Vec2_t<StorageReal> bodiesCoMPosition() const;
+	[[nodiscard]] Vec2_t<StorageReal> systemCoMPosition() const;
+
+	// Initializes the members every constructor does before filling in the bodies.
+	Sim();
+	// Builds the tree, or restores it from checkpoint if given and it was saved in the same precision.
+	void initializeTree(const Checkpoint* checkpoint = nullptr);
+	void initializeWindow();
+	// Computes accelerations and kicks velocities ahead by half the first kick of a step.
 	void initializeVelocities();
+	// Undoes the half kick velocities were saved with for a different integrator or delta time, then initializes them
+	// again. The saving run's accelerations are recomputed, so this is only exact if the forces are.
+	void resynchronizeVelocities(const CheckpointState& state);
+	// Puts each body on the timestep level its acceleration needs and kicks it ahead by half its level's first kick.
+	void halfKickVelocities();
+	// Whether forces are summed directly, for SOLVER DIRECT, a THETA of 0 or at most DIRECTSUMMAXBODIES bodies.
+	[[nodiscard]] bool usesDirectSum() const;
+	// Fills m_accelerations using the solver selected by SOLVER or usesDirectSum, only for the bodies set in active if
+	// given.
+	void computeAccelerations(const std::vector<uint8_t>* active = nullptr);
+	// Updates the quadtree, reordering the body arrays into tree order if it was rebuilt and REORDERBODIES is set.
+	void updateQuadTree();
+	void reorderBodies();
 
 	void updateScreenDims();
 	void takeInput();
+	// Updates, then writes a trajectory frame if one is due.
+	void step();
+	void saveCheckpointIfDue() const;
+	void writeTrajectoryFrame();
+
+	void stepLoop();
+	// Run from the main thread between steps. Swaps in the completed step's snapshot, applies the pending input and
+	// starts the next step unless paused.
+	void betweenSteps();
+	void applyPendingInput();
+	void fillSnapshot(Snapshot& snapshot) const;
+	[[nodiscard]] const Snapshot& frontSnapshot() const;
 	void update();
-	void draw() const;
+	// Runs func on every body index in parallel, timed as integration.
+	template <typename Func>
+	void forEachBody(Func func);
+	// Advances a frame in sub-steps when BLOCKTIMESTEPLEVELS is more than 1.
+	void updateBlockTimesteps();
+	// Fills and uploads m_bodyInstances from the front snapshot, colored by the colormap selected by COLORMAPMODE, if
+	// either has changed since the last frame.
+	void updateBodyInstances();
+	void draw();
 
 	void drawDetails() const;
+	void drawTimings() const;
 	static void drawControls() ;
 
 	static void drawTextRJust(const char* text, int x, int y, int fontSize, Color color);
@@ -0,0 +1,84 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#ifndef GRAV_SIM_CPU_TIMINGS_HPP
+#define GRAV_SIM_CPU_TIMINGS_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+
+// The phases of a frame that are timed. The tree build is split into its own phases.
+enum class TimingPhase
+{
+	TreeBounds, TreeSort, TreeNodes, TreeLayout, TreeRefit, Reorder, Forces, Integration, Trajectory, Snapshot,
+	BodyInstances, Draw
+};
+
+constexpr int TIMING_PHASE_COUNT = static_cast<int>(TimingPhase::Draw) + 1;
+// Frames kept for the frame time graph.
+constexpr int TIMING_HISTORY_SIZE = 120;
+
+const char* timingPhaseToString(TimingPhase phase);
+
+// Time spent in each phase of the current frame, and a running average and history of past frames. Phase times can be
+// added from any thread, but everything else is only to be used from the main thread. Phases of a step running on
+// another thread count towards the frame they finish in.
+class Timings
+{
+public:
+	void addPhaseTime(TimingPhase phase, double milliseconds);
+	// Folds the current frame into the averages and history, and writes it to the CSV file if one is open. The frame's
+	// time is the time since the last call.
+	void endFrame();
+	// Writes a row of per-phase milliseconds to path at the end of every frame.
+	void openCsv(const char* path);
+
+	// Exponential moving average of the phase's milliseconds per frame.
+	[[nodiscard]] double averagePhaseTime(TimingPhase phase) const;
+	[[nodiscard]] double averageFrameTime() const;
+	// Milliseconds of the last TIMING_HISTORY_SIZE frames, oldest first starting from getFrameHistoryStart().
+	[[nodiscard]] const std::array<float, TIMING_HISTORY_SIZE>& getFrameHistory() const;
+	[[nodiscard]] int getFrameHistoryStart() const;
+
+private:
+	// Guards m_framePhaseTimes.
+	std::mutex m_mutex;
+	std::array<double, TIMING_PHASE_COUNT> m_framePhaseTimes = {};
+	std::array<double, TIMING_PHASE_COUNT> m_averagePhaseTimes = {};
+	double m_averageFrameTime = 0;
+
+	std::array<float, TIMING_HISTORY_SIZE> m_frameHistory = {};
+	int m_frameHistoryStart = 0;
+
+	std::chrono::steady_clock::time_point m_lastFrameEnd = std::chrono::steady_clock::now();
+	uint64_t m_frameCount = 0;
+
+	std::ofstream m_csv;
+};
+
+extern Timings g_timings;
+
+// Adds the time between its construction and destruction to a phase of g_timings.
+class ScopedTimer
+{
+public:
+	explicit ScopedTimer(const TimingPhase phase) : m_phase(phase), m_start(std::chrono::steady_clock::now()) { }
+	~ScopedTimer()
+	{
+		g_timings.addPhaseTime(m_phase,
+			std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count());
+	}
+
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+	TimingPhase m_phase;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+#endif //GRAV_SIM_CPU_TIMINGS_HPP
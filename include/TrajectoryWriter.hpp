@@ -0,0 +1,123 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#ifndef GRAV_SIM_CPU_TRAJECTORY_WRITER_HPP
+#define GRAV_SIM_CPU_TRAJECTORY_WRITER_HPP
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common.hpp"
+#include "parameters.hpp"
+
+// Trajectory files are a header followed by a frame per written step. Each frame is a TrajectoryFrameHeader, giving
+// its step and simulated time as the delta time can change and reverse between frames, and then its payload: the
+// positions as given by the header's encoding, then the velocities as raw Reals. Bodies are always in generation order,
+// and everything is in the machine's byte order, which the header records.
+//     RAW: x and y of each body as Reals.
+//     QUANTIZED: x and y of each body divided by the quantum and rounded, as int32s saturated at +-INT32_MAX.
+//                Coordinates that aren't finite are written as INT32_MIN.
+//     DELTA: x and y of each body quantized the same way but saturated at +-TRAJECTORY_DELTA_LIMIT, with coordinates
+//            that aren't finite quantized to -TRAJECTORY_DELTA_LIMIT - 1. Written as the difference from the body's in
+//            the last frame (0 in the first), zigzag encoded as LEB128 varints.
+
+constexpr uint32_t TRAJECTORY_VERSION = 2;
+// Small enough that the difference between any two quantized DELTA coordinates fits in an int64.
+constexpr int64_t TRAJECTORY_DELTA_LIMIT = int64_t{1} << 61;
+
+struct TrajectoryHeader
+{
+	std::array<char, 8> magic;
+	uint32_t version;
+	// Reads back as a different value on machines of the other byte order.
+	uint32_t byteOrderMark;
+	uint64_t bodyCount;
+	// Size of the Reals positions and velocities are written in.
+	uint32_t realSize;
+	// A TrajectoryEncoding.
+	uint32_t encoding;
+	double quantum;
+};
+
+struct TrajectoryFrameHeader
+{
+	uint64_t step;
+	double time;
+	uint64_t payloadSize;
+};
+
+// Writes trajectory frames to a file from a background thread. Frames are copied into a pool of TRAJECTORYBUFFERS
+// buffers by submit, and encoded and written by the thread, so the caller only waits on the disk when every buffer is
+// queued and TRAJECTORYBACKPRESSURE is BLOCK. Encoding parameters are read from the globals on construction.
+template <typename Real>
+class TrajectoryWriter
+{
+public:
+	TrajectoryWriter(const char* path, size_t bodyCount);
+	// Writes every queued frame before returning.
+	~TrajectoryWriter();
+
+	TrajectoryWriter(const TrajectoryWriter&) = delete;
+	TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+	// Queues a frame of the bodies, put back into generation order by bodyIds. Rethrows anything the writer thread
+	// threw since the last call.
+	void submit(uint64_t step, double time, const std::vector<Vec2_t<Real>>& positions,
+		const std::vector<Vec2_t<Real>>& velocities, const std::vector<BodyIndex_t>& bodyIds);
+
+	[[nodiscard]] uint64_t getWrittenFrames() const;
+	[[nodiscard]] uint64_t getDroppedFrames() const;
+
+private:
+	struct Frame
+	{
+		uint64_t step = 0;
+		double time = 0;
+		std::vector<Vec2_t<Real>> positions;
+		std::vector<Vec2_t<Real>> velocities;
+	};
+
+	std::ofstream m_file;
+	size_t m_bodyCount;
+	TrajectoryEncoding m_encoding;
+	double m_quantum;
+	TrajectoryBackpressure m_backpressure;
+
+	// Every body index, to copy frames over in parallel.
+	std::vector<BodyIndex_t> m_indices;
+
+	std::vector<Frame> m_frames;
+	// Frames free to be filled, and filled frames waiting to be written in order.
+	std::vector<Frame*> m_freeFrames;
+	std::deque<Frame*> m_queuedFrames;
+	std::mutex m_mutex;
+	std::condition_variable m_frameFreed;
+	std::condition_variable m_frameQueued;
+	bool m_stopping = false;
+	std::exception_ptr m_error;
+
+	std::atomic<uint64_t> m_writtenFrames = 0;
+	std::atomic<uint64_t> m_droppedFrames = 0;
+
+	// Only touched by the writer thread.
+	std::vector<char> m_payload;
+	std::vector<std::array<int64_t, 2>> m_lastQuantized;
+
+	// Started last, once everything it uses is constructed.
+	std::thread m_thread;
+
+	void writeLoop();
+	void writeFrame(const Frame& frame);
+	void encodePositions(const Frame& frame);
+};
+
+#endif //GRAV_SIM_CPU_TRAJECTORY_WRITER_HPP
@@ -10,6 +10,10 @@
 
 using BodyIndex_t = uint32_t;
 
+// Vector of the scalar type bodies and trees are stored in, see PRECISION.
+template <typename Real>
+using Vec2_t = glm::vec<2, Real>;
+
 using Vec2It_t = std::vector<glm::vec2>::iterator;
 using FloatIt_t = std::vector<float>::iterator;
 using IndexIt_t = std::vector<BodyIndex_t>::iterator;
@@ -0,0 +1,117 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#ifndef GRAV_SIM_CPU_GRAVITY_HPP
+#define GRAV_SIM_CPU_GRAVITY_HPP
+
+#include <cmath>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/norm.hpp>
+
+#include "CoM.hpp"
+#include "parameters.hpp"
+
+// Pairs of bodies closer than this are ignored rather than producing NaNs/infs. Also how a body discards itself.
+static constexpr float SQR_DIST_EPSILON = 0.1f;
+
+// Gravity parameters, read from the globals once per force computation and passed down by value, so the hot loops never
+// reread them.
+template <typename Real>
+struct ForceParams
+{
+	Real gravConst;
+	Real gravSmoothness;
+	// Square of THETA, as the opening criterion compares squared sizes and distances.
+	Real sqrTheta;
+
+	static ForceParams fromGlobals()
+	{
+		return {static_cast<Real>(g_gravConst), static_cast<Real>(g_gravSmoothness),
+			static_cast<Real>(g_theta) * static_cast<Real>(g_theta)};
+	}
+};
+
+// The force law, specialised at compile time so unsoftened gravity and a gravitational constant of 1 drop their
+// arithmetic from the hot loops. Every ForceLaw gives the same results for the ForceParams withForceLaw picks it for.
+template <bool Softened, bool ScaledGravConst>
+struct ForceLaw
+{
+	template <typename Real>
+	static Real softSqrDist(const ForceParams<Real> params, const Real sqrDist)
+	{
+		if constexpr (Softened)
+			return params.gravSmoothness + sqrDist;
+		else
+			return sqrDist;
+	}
+
+	template <typename Real>
+	static Real gravConst(const ForceParams<Real> params)
+	{
+		if constexpr (ScaledGravConst)
+			return params.gravConst;
+		else
+			return 1;
+	}
+};
+
+// Calls func.template operator()<Law>() with the ForceLaw specialised for params.
+template <typename Real, typename Func>
+decltype(auto) withForceLaw(const ForceParams<Real> params, Func&& func)
+{
+	const bool softened = params.gravSmoothness != 0;
+	const bool scaledGravConst = params.gravConst != 1;
+
+	if (softened && scaledGravConst)
+		return func.template operator()<ForceLaw<true, true>>();
+	if (softened)
+		return func.template operator()<ForceLaw<true, false>>();
+	if (scaledGravConst)
+		return func.template operator()<ForceLaw<false, true>>();
+	return func.template operator()<ForceLaw<false, false>>();
+}
+
+template <typename Law, typename Real>
+Vec2_t<Real> gravAccel(const Vec2_t<Real> position, const Vec2_t<Real> sourcePosition, const Real sourceMass,
+	const ForceParams<Real> params)
+{
+	const Vec2_t<Real> rel = sourcePosition - position;
+	const Real sqrDist = glm::length2(rel);
+
+	if (sqrDist <= SQR_DIST_EPSILON)
+		return {};
+
+	const Vec2_t<Real> dir = rel / std::sqrt(sqrDist);
+
+	return dir * (Law::gravConst(params) * sourceMass / Law::softSqrDist(params, sqrDist));
+}
+
+// Acceleration due to a node with the quadrupole correction from its second moments. rel is from position to the
+// node's CoM. Derivatives of the potential whose gradient is gravAccel's force, written in terms of sqrDist.
+template <typename Law, typename Real>
+Vec2_t<Real> nodeGravAccel(const Vec2_t<Real> rel, const Real sqrDist, const CoM<Real>& com,
+	const ForceParams<Real> params)
+{
+	const Real invSqrDist = 1 / sqrDist;
+	const Real invSoftSqrDist = 1 / Law::softSqrDist(params, sqrDist);
+	const Real sum = invSqrDist + 2 * invSoftSqrDist;
+
+	const Real firstDeriv = std::sqrt(invSqrDist) * invSoftSqrDist;
+	const Real secondDeriv = -firstDeriv * sum;
+	const Real thirdDeriv = firstDeriv *
+		(sum * sum + 2 * invSqrDist * invSqrDist + 4 * invSoftSqrDist * invSoftSqrDist);
+
+	const Vec2_t<Real> momentRel = {com.momentXX * rel.x + com.momentXY * rel.y,
+		com.momentXY * rel.x + com.momentYY * rel.y};
+	const Real relMomentRel = glm::dot(rel, momentRel);
+	const Real trace = com.momentXX + com.momentYY;
+
+	const Vec2_t<Real> monopole = com.mass * firstDeriv * rel;
+	const Vec2_t<Real> quadrupole = static_cast<Real>(0.5) * (thirdDeriv * relMomentRel * rel +
+		secondDeriv * (trace * rel + static_cast<Real>(2) * momentRel));
+
+	return Law::gravConst(params) * (monopole + quadrupole);
+}
+
+#endif //GRAV_SIM_CPU_GRAVITY_HPP
@@ -0,0 +1,59 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#ifndef GRAV_SIM_CPU_GRAVITY_KERNELS_HPP
+#define GRAV_SIM_CPU_GRAVITY_KERNELS_HPP
+
+#include <cstddef>
+#include <vector>
+#include <glm/vec2.hpp>
+
+#include "CoM.hpp"
+#include "gravity.hpp"
+
+// Batched versions of gravAccel and nodeGravAccel, summing many sources at one position. The float kernels run on the
+// widest instruction set the CPU supports, picked once at startup. The double kernels are scalar, as they're only used
+// when accuracy matters more than speed.
+
+// Sources as structures of arrays, so the kernels can load a lane's worth of each field at once.
+template <typename Real>
+struct BodySources
+{
+	std::vector<Real> xs;
+	std::vector<Real> ys;
+	std::vector<Real> masses;
+
+	void clear();
+	void append(const Real* sourceXs, const Real* sourceYs, const Real* sourceMasses, size_t count);
+};
+
+template <typename Real>
+struct NodeSources
+{
+	std::vector<Real> xs;
+	std::vector<Real> ys;
+	std::vector<Real> masses;
+	std::vector<Real> momentXXs;
+	std::vector<Real> momentXYs;
+	std::vector<Real> momentYYs;
+
+	void clear();
+	void push_back(const CoM<Real>& com);
+};
+
+// Sum of gravAccel at position over count bodies. Bodies within SQR_DIST_EPSILON of position are discarded.
+glm::vec2 bodyAccelSum(glm::vec2 position, const float* xs, const float* ys, const float* masses, size_t count,
+	ForceParams<float> params);
+glm::dvec2 bodyAccelSum(glm::dvec2 position, const double* xs, const double* ys, const double* masses, size_t count,
+	ForceParams<double> params);
+glm::vec2 bodyAccelSum(glm::vec2 position, const BodySources<float>& sources, ForceParams<float> params);
+glm::dvec2 bodyAccelSum(glm::dvec2 position, const BodySources<double>& sources, ForceParams<double> params);
+// Sum of nodeGravAccel at position over the nodes. Nodes within SQR_DIST_EPSILON of position are discarded.
+glm::vec2 nodeAccelSum(glm::vec2 position, const NodeSources<float>& sources, ForceParams<float> params);
+glm::dvec2 nodeAccelSum(glm::dvec2 position, const NodeSources<double>& sources, ForceParams<double> params);
+
+// Name of the instruction set the kernels run on.
+const char* kernelInstructionSet();
+
+#endif //GRAV_SIM_CPU_GRAVITY_KERNELS_HPP
@@ -0,0 +1,47 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#ifndef GRAV_SIM_CPU_INTEGRATORS_HPP
+#define GRAV_SIM_CPU_INTEGRATORS_HPP
+
+#include <array>
+#include <span>
+
+#include "parameters.hpp"
+
+// A symplectic integrator, as the fractions of a step each body is kicked and then drifted by in turn. Forces are
+// computed before every kick, and the tree updated after every drift. Each scheme's last kick is merged into the first
+// kick of the next step, so velocities are started off with half of the first kick.
+struct IntegratorScheme
+{
+	std::span<const double> kicks;
+	std::span<const double> drifts;
+
+	[[nodiscard]] int forceEvaluations() const { return static_cast<int>(kicks.size()); }
+};
+
+static constexpr std::array<double, 1> LEAPFROG_KICKS = {1};
+static constexpr std::array<double, 1> LEAPFROG_DRIFTS = {1};
+
+// Three leapfrog steps of W1, W0 and W1 of the step, chosen so their third order errors cancel.
+static constexpr double FOREST_RUTH_W1 = 1 / (2 - 1.2599210498948732); // 1 / (2 - cbrt(2))
+static constexpr double FOREST_RUTH_W0 = 1 - 2 * FOREST_RUTH_W1;
+static constexpr std::array<double, 3> FOREST_RUTH_KICKS =
+	{FOREST_RUTH_W1, (FOREST_RUTH_W1 + FOREST_RUTH_W0) / 2, (FOREST_RUTH_W0 + FOREST_RUTH_W1) / 2};
+static constexpr std::array<double, 3> FOREST_RUTH_DRIFTS = {FOREST_RUTH_W1, FOREST_RUTH_W0, FOREST_RUTH_W1};
+
+inline IntegratorScheme integratorScheme(const Integrator integrator)
+{
+	switch (integrator)
+	{
+	case Integrator::Leapfrog:
+		return {LEAPFROG_KICKS, LEAPFROG_DRIFTS};
+	case Integrator::ForestRuth:
+		return {FOREST_RUTH_KICKS, FOREST_RUTH_DRIFTS};
+	}
+
+	return {LEAPFROG_KICKS, LEAPFROG_DRIFTS}; // Unreachable.
+}
+
+#endif //GRAV_SIM_CPU_INTEGRATORS_HPP
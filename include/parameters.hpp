@@ -5,6 +5,8 @@
 #ifndef GRAV_SIM_CPU_CONFIG_HPP
 #define GRAV_SIM_CPU_CONFIG_HPP
 
+#include <istream>
+#include <string>
 #include <glm/glm.hpp>
 
 #include "colormap.hpp"
@@ -18,6 +20,58 @@ enum class ColormapMode
 
 const char* colormapModeToString(ColormapMode mode);
 
+enum class TreeBuilder
+{
+    Partition, Morton
+};
+
+const char* treeBuilderToString(TreeBuilder builder);
+
+enum class ForceTraversal
+{
+    Body, Group
+};
+
+const char* forceTraversalToString(ForceTraversal traversal);
+
+enum class Solver
+{
+    BarnesHut, FMM, Direct
+};
+
+const char* solverToString(Solver solver);
+
+constexpr int MAX_FMM_ORDER = 12;
+constexpr int MAX_BLOCK_TIMESTEP_LEVELS = 16;
+
+enum class Precision
+{
+    Float, Double, Mixed
+};
+
+const char* precisionToString(Precision precision);
+
+enum class Integrator
+{
+    Leapfrog, ForestRuth
+};
+
+const char* integratorToString(Integrator integrator);
+
+enum class TrajectoryEncoding
+{
+    Raw, Quantized, Delta
+};
+
+const char* trajectoryEncodingToString(TrajectoryEncoding encoding);
+
+enum class TrajectoryBackpressure
+{
+    Block, Drop
+};
+
+const char* trajectoryBackpressureToString(TrajectoryBackpressure backpressure);
+
 // Defined in parameters.cpp when loading simulation config file.
 extern float g_theta;
 extern float g_gravConst;
@@ -37,6 +91,31 @@ extern ColormapMode g_colormapMode;
 extern float g_colormapMaxSpeed;
 extern float g_colormapMaxSqrSpeed;
 
+extern TreeBuilder g_treeBuilder;
+extern int g_treeRebuildInterval;
+extern float g_treeRefitMaxGrowth;
+extern int g_leafSize;
+extern ForceTraversal g_forceTraversal;
+extern int g_groupSize;
+extern Solver g_solver;
+extern int g_fmmOrder;
+extern float g_fmmTheta;
+extern bool g_reorderBodies;
+extern Precision g_precision;
+extern int g_blockTimestepLevels;
+extern float g_blockTimestepTolerance;
+extern Integrator g_integrator;
+extern int g_directSumMaxBodies;
+extern int g_trajectoryInterval;
+extern TrajectoryEncoding g_trajectoryEncoding;
+extern float g_trajectoryQuantum;
+extern int g_trajectoryBuffers;
+extern TrajectoryBackpressure g_trajectoryBackpressure;
+
 void loadSimulationFile(const char* simulationPath);
+// Loads parameters in the format of the simulation config file.
+void loadSimulationParameters(std::istream& file);
+// The current parameters in the format of the simulation config file.
+std::string simulationParametersToString();
 
 #endif //GRAV_SIM_CPU_CONFIG_HPP
\ No newline at end of file
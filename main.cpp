@@ -1,18 +1,85 @@
+#include <charconv>
+#include <chrono>
+#include <cmath>
 #include <cstring>
+#include <format>
 #include <iostream>
+#include <memory>
+#include <optional>
 
+#include "Checkpoint.hpp"
 #include "Sim.hpp"
+#include "Timings.hpp"
+
+// Where and how often checkpoints are saved, and where the trajectory is written if anywhere.
+struct OutputOptions
+{
+	const char* checkpointPath = DEFAULT_CHECKPOINT_PATH;
+	uint64_t checkpointInterval = 0;
+	const char* trajectoryPath = nullptr;
+};
+
+// Runs the simulation in a window, or for headlessSteps steps without one if given. The bodies are restored from
+// checkpoint if given, otherwise generated.
+template <typename StorageReal, typename ForceReal>
+static void runSim(const char* generationPath, const Checkpoint* checkpoint, const OutputOptions& outputOptions,
+	const std::optional<uint64_t> headlessSteps)
+{
+	const bool headless = headlessSteps.has_value();
+	const auto sim = checkpoint ? std::make_unique<Sim<StorageReal, ForceReal>>(*checkpoint, headless)
+		: std::make_unique<Sim<StorageReal, ForceReal>>(generationPath, headless);
+	sim->setCheckpointing(outputOptions.checkpointPath, outputOptions.checkpointInterval);
+	if (outputOptions.trajectoryPath)
+		sim->setTrajectoryOutput(outputOptions.trajectoryPath);
+
+	if (!headless)
+	{
+		sim->run();
+		return;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	sim->runHeadless(*headlessSteps);
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	const auto steps = static_cast<double>(*headlessSteps);
+	std::cout << std::format("Ran {} steps of {} bodies ({} simulated time) in {:.3f}s.\n"
+		"\t{:.2f} steps/s\n"
+		"\t{:.4g} body updates/s\n",
+		*headlessSteps, sim->getBodyCount(), steps * g_deltaTime, seconds,
+		steps / seconds, steps * static_cast<double>(sim->getBodyCount()) / seconds);
+}
+
+// Parses all of text as a number, returning false if it isn't one.
+template <typename T>
+static bool parseNumber(const char* text, T& value)
+{
+	const char* end = text + strlen(text);
+	const auto [ptr, ec] = std::from_chars(text, end, value);
+	return ec == std::errc() && ptr == end;
+}
 
 int main(const int argc, const char* argv[])
 {
 	if (argc > 1 && strcmp(argv[1], "--help") == 0)
 	{
 		std::cout << "Options:\n" <<
+			"\t--checkpoint: Path to save checkpoints to, with the K key or every --checkpoint-interval steps. "
+			"checkpoint.bin by default.\n" <<
+			"\t--checkpoint-interval: Number of steps between saving checkpoints automatically. Never by default.\n" <<
 			"\t-g | --generation: Path to generation config file. Looks for a file called generation.cfg in the same "
 			"directory by default.\n" <<
+			"\t--headless: Run without a window as fast as possible for the number of steps or simulated time given by "
+			"--steps or --time, then print the throughput.\n" <<
 			"\t--help: Display this message.\n" <<
+			"\t-n | --steps: Number of steps to run with --headless.\n" <<
+			"\t-r | --restore: Path to a checkpoint to restore the bodies and simulation parameters from instead of "
+			"generating them. The simulation parameters are overridden by --simulation if it's also given.\n" <<
 			"\t-s | --simulation: Path to simulation config file. Looks for a file called simulation.cfg in the same "
-		    "directory by default.";
+		    "directory by default.\n" <<
+			"\t-t | --time: Simulated time to run with --headless, rounded up to a whole number of steps.\n" <<
+			"\t--trajectory: Path to write every body's position and velocity to every TRAJECTORYINTERVAL steps.\n" <<
+			"\t--timings: Path to write the time each phase took every frame (or step with --headless) to as CSV.";
 
 		return 0;
 	}
@@ -20,6 +87,15 @@ int main(const int argc, const char* argv[])
 	// Config file default paths.
 	const char* generationPath = "generation.cfg";
 	const char* simulationPath = "simulation.cfg";
+	bool simulationPathGiven = false;
+
+	const char* timingsPath = nullptr;
+	const char* restorePath = nullptr;
+	OutputOptions outputOptions;
+
+	bool headless = false;
+	std::optional<uint64_t> steps;
+	std::optional<double> simulatedTime;
 
 	for (int i = 1; i < argc; ++i)
 	{
@@ -44,6 +120,79 @@ int main(const int argc, const char* argv[])
 			}
 
 			simulationPath = argv[i];
+			simulationPathGiven = true;
+		}
+		else if (strcmp(option, "-r") == 0 || strcmp(option, "--restore") == 0)
+		{
+			if (++i >= argc)
+			{
+				std::cerr << "No argument supplied for restore file.\n";
+				return 64;
+			}
+
+			restorePath = argv[i];
+		}
+		else if (strcmp(option, "--checkpoint") == 0)
+		{
+			if (++i >= argc)
+			{
+				std::cerr << "No argument supplied for checkpoint file.\n";
+				return 64;
+			}
+
+			outputOptions.checkpointPath = argv[i];
+		}
+		else if (strcmp(option, "--checkpoint-interval") == 0)
+		{
+			if (++i >= argc || !parseNumber(argv[i], outputOptions.checkpointInterval))
+			{
+				std::cerr << "No valid step count supplied for checkpoint interval.\n";
+				return 64;
+			}
+		}
+		else if (strcmp(option, "--timings") == 0)
+		{
+			if (++i >= argc)
+			{
+				std::cerr << "No argument supplied for timings file.\n";
+				return 64;
+			}
+
+			timingsPath = argv[i];
+		}
+		else if (strcmp(option, "--trajectory") == 0)
+		{
+			if (++i >= argc)
+			{
+				std::cerr << "No argument supplied for trajectory file.\n";
+				return 64;
+			}
+
+			outputOptions.trajectoryPath = argv[i];
+		}
+		else if (strcmp(option, "--headless") == 0)
+			headless = true;
+		else if (strcmp(option, "-n") == 0 || strcmp(option, "--steps") == 0)
+		{
+			uint64_t value;
+			if (++i >= argc || !parseNumber(argv[i], value))
+			{
+				std::cerr << "No valid step count supplied for steps.\n";
+				return 64;
+			}
+
+			steps = value;
+		}
+		else if (strcmp(option, "-t") == 0 || strcmp(option, "--time") == 0)
+		{
+			double value;
+			if (++i >= argc || !parseNumber(argv[i], value) || !(value >= 0))
+			{
+				std::cerr << "No valid simulated time supplied for time.\n";
+				return 64;
+			}
+
+			simulatedTime = value;
 		}
 		else
 		{
@@ -52,11 +201,49 @@ int main(const int argc, const char* argv[])
 		}
 	}
 
+	if (headless && steps.has_value() == simulatedTime.has_value())
+	{
+		std::cerr << "Exactly one of steps or time must be supplied with headless.\n";
+		return 64;
+	}
+	if (!headless && (steps || simulatedTime))
+	{
+		std::cerr << "Steps and time can only be supplied with headless.\n";
+		return 64;
+	}
+
 	try
 	{
-		loadSimulationFile(simulationPath);
-		Sim sim(generationPath);
-		sim.run();
+		// Kept mapped until the bodies have been copied out of it.
+		std::optional<Checkpoint> checkpoint;
+		if (restorePath)
+		{
+			checkpoint.emplace(restorePath);
+			checkpoint->loadParameters();
+		}
+		if (!restorePath || simulationPathGiven)
+			loadSimulationFile(simulationPath);
+
+		if (timingsPath)
+			g_timings.openCsv(timingsPath);
+
+		// Only known once the timescale and target FPS have been loaded.
+		if (simulatedTime)
+			steps = static_cast<uint64_t>(std::ceil(*simulatedTime / g_deltaTime));
+
+		const Checkpoint* restored = checkpoint ? &*checkpoint : nullptr;
+		switch (g_precision)
+		{
+		case Precision::Float:
+			runSim<float, float>(generationPath, restored, outputOptions, steps);
+			break;
+		case Precision::Double:
+			runSim<double, double>(generationPath, restored, outputOptions, steps);
+			break;
+		case Precision::Mixed:
+			runSim<double, float>(generationPath, restored, outputOptions, steps);
+			break;
+		}
 	}
 	catch (std::exception& e)
 	{
@@ -0,0 +1,135 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#include "BodyRenderer.hpp"
+
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <raymath.h>
+#include <rlgl.h>
+
+// Attribute locations, matching the layout qualifiers in the vertex shader.
+static constexpr int CORNER_ATTRIBUTE = 0;
+static constexpr int POSITION_ATTRIBUTE = 1;
+static constexpr int DIAMETER_ATTRIBUTE = 2;
+static constexpr int COLOR_ATTRIBUTE = 3;
+
+static constexpr const char* BODY_VERTEX_SHADER = R"(#version 330
+
+layout(location = 0) in vec2 corner;
+layout(location = 1) in vec2 position;
+layout(location = 2) in float diameter;
+layout(location = 3) in vec4 color;
+
+uniform mat4 mvp;
+
+out vec2 fragTexCoord;
+out vec4 fragColor;
+
+void main()
+{
+	fragTexCoord = corner + 0.5;
+	fragColor = color;
+	gl_Position = mvp * vec4(position + corner * diameter, 0.0, 1.0);
+}
+)";
+
+static constexpr const char* BODY_FRAGMENT_SHADER = R"(#version 330
+
+in vec2 fragTexCoord;
+in vec4 fragColor;
+
+uniform sampler2D texture0;
+
+out vec4 finalColor;
+
+void main()
+{
+	finalColor = texture(texture0, fragTexCoord) * fragColor;
+}
+)";
+
+// Two triangles covering a unit square around the origin, wound the same way as Raylib's own quads.
+static constexpr std::array<float, 12> QUAD_CORNERS = {
+	-0.5f, -0.5f,  -0.5f, 0.5f,  0.5f, 0.5f,
+	-0.5f, -0.5f,   0.5f, 0.5f,  0.5f, -0.5f
+};
+
+void BodyRenderer::load(const Texture2D texture)
+{
+	m_texture = texture;
+
+	m_shader = LoadShaderFromMemory(BODY_VERTEX_SHADER, BODY_FRAGMENT_SHADER);
+	if (!IsShaderValid(m_shader))
+		throw std::runtime_error("Failed to compile the body shader.");
+	m_mvpLocation = GetShaderLocation(m_shader, "mvp");
+	m_textureLocation = GetShaderLocation(m_shader, "texture0");
+
+	m_vertexArray = rlLoadVertexArray();
+	rlEnableVertexArray(m_vertexArray);
+
+	m_quadBuffer = rlLoadVertexBuffer(QUAD_CORNERS.data(), sizeof(QUAD_CORNERS), false);
+	rlSetVertexAttribute(CORNER_ATTRIBUTE, 2, RL_FLOAT, false, 0, 0);
+	rlEnableVertexAttribute(CORNER_ATTRIBUTE);
+
+	rlDisableVertexArray();
+}
+
+void BodyRenderer::setInstances(const std::vector<BodyInstance>& instances)
+{
+	if (instances.size() > m_instanceCapacity)
+		loadInstanceBuffer(instances.size());
+
+	rlUpdateVertexBuffer(m_instanceBuffer, instances.data(), static_cast<int>(instances.size() * sizeof(BodyInstance)),
+		0);
+	m_instanceCount = instances.size();
+}
+
+void BodyRenderer::draw() const
+{
+	if (m_instanceCount == 0)
+		return;
+
+	// Anything Raylib has batched so far has to be drawn first to stay underneath.
+	rlDrawRenderBatchActive();
+
+	rlEnableShader(m_shader.id);
+	rlSetUniformMatrix(m_mvpLocation, MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection()));
+
+	constexpr int textureSlot = 0;
+	rlActiveTextureSlot(textureSlot);
+	rlEnableTexture(m_texture.id);
+	rlSetUniform(m_textureLocation, &textureSlot, RL_SHADER_UNIFORM_INT, 1);
+
+	rlEnableVertexArray(m_vertexArray);
+	rlDrawVertexArrayInstanced(0, static_cast<int>(QUAD_CORNERS.size() / 2), static_cast<int>(m_instanceCount));
+	rlDisableVertexArray();
+
+	rlDisableTexture();
+	rlDisableShader();
+}
+
+void BodyRenderer::loadInstanceBuffer(const size_t capacity)
+{
+	rlEnableVertexArray(m_vertexArray);
+
+	if (m_instanceBuffer != 0)
+		rlUnloadVertexBuffer(m_instanceBuffer);
+	m_instanceBuffer = rlLoadVertexBuffer(nullptr, static_cast<int>(capacity * sizeof(BodyInstance)), true);
+	m_instanceCapacity = capacity;
+
+	// Each attribute steps once per body rather than once per corner.
+	constexpr int stride = sizeof(BodyInstance);
+	rlSetVertexAttribute(POSITION_ATTRIBUTE, 2, RL_FLOAT, false, stride, offsetof(BodyInstance, position));
+	rlSetVertexAttribute(DIAMETER_ATTRIBUTE, 1, RL_FLOAT, false, stride, offsetof(BodyInstance, diameter));
+	rlSetVertexAttribute(COLOR_ATTRIBUTE, 4, RL_UNSIGNED_BYTE, true, stride, offsetof(BodyInstance, color));
+	for (const int attribute : {POSITION_ATTRIBUTE, DIAMETER_ATTRIBUTE, COLOR_ATTRIBUTE})
+	{
+		rlSetVertexAttributeDivisor(attribute, 1);
+		rlEnableVertexAttribute(attribute);
+	}
+
+	rlDisableVertexArray();
+}
@@ -0,0 +1,192 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#include "Checkpoint.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "parameters.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define GRAV_SIM_MMAP_CHECKPOINTS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static constexpr std::array<char, 8> CHECKPOINT_MAGIC = {'G', 'R', 'A', 'V', 'S', 'I', 'M', '\0'};
+static constexpr uint32_t CHECKPOINT_BYTE_ORDER_MARK = 0x01020304;
+
+static uint64_t alignOffset(const uint64_t offset)
+{
+	return (offset + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+}
+
+static void writePadding(std::ofstream& file, const uint64_t offset)
+{
+	static constexpr std::array<char, CHECKPOINT_ALIGNMENT> ZEROS = {};
+	file.write(ZEROS.data(), static_cast<std::streamsize>(alignOffset(offset) - offset));
+}
+
+void writeCheckpoint(const char* path, const uint64_t bodyCount, const CheckpointState& state,
+	const std::string& parameters, const std::array<CheckpointColumnData, CHECKPOINT_COLUMN_COUNT>& columns)
+{
+	CheckpointHeader header = {};
+	header.magic = CHECKPOINT_MAGIC;
+	header.version = CHECKPOINT_VERSION;
+	header.byteOrderMark = CHECKPOINT_BYTE_ORDER_MARK;
+	header.bodyCount = bodyCount;
+	header.state = state;
+	header.parametersOffset = alignOffset(sizeof(CheckpointHeader));
+	header.parametersSize = parameters.size();
+
+	uint64_t offset = alignOffset(header.parametersOffset + header.parametersSize);
+	for (int i = 0; i < CHECKPOINT_COLUMN_COUNT; ++i)
+	{
+		header.columns[i] = {offset, columns[i].count, columns[i].elementSize, 0};
+		offset = alignOffset(offset + columns[i].count * columns[i].elementSize);
+	}
+
+	const std::string tempPath = std::string(path) + ".tmp";
+
+	{
+		std::ofstream file(tempPath, std::ios::binary);
+		if (!file.is_open())
+			throw std::runtime_error(std::format("Failed to open checkpoint file given path {}.", tempPath));
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		writePadding(file, sizeof(header));
+
+		file.write(parameters.data(), static_cast<std::streamsize>(parameters.size()));
+		writePadding(file, header.parametersOffset + header.parametersSize);
+
+		for (int i = 0; i < CHECKPOINT_COLUMN_COUNT; ++i)
+		{
+			const uint64_t size = columns[i].count * columns[i].elementSize;
+			file.write(static_cast<const char*>(columns[i].data), static_cast<std::streamsize>(size));
+			writePadding(file, header.columns[i].offset + size);
+		}
+
+		if (!file)
+			throw std::runtime_error(std::format("Failed writing checkpoint file {}.", tempPath));
+	}
+
+	std::filesystem::rename(tempPath, path);
+}
+
+Checkpoint::Checkpoint(const char* path) : m_path(path)
+{
+#ifdef GRAV_SIM_MMAP_CHECKPOINTS
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error(std::format("Failed to open checkpoint file given path {}.", path));
+
+	struct stat status = {};
+	if (fstat(fd, &status) == 0 && status.st_size > 0)
+	{
+		void* mapping = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED)
+		{
+			m_data = static_cast<const std::byte*>(mapping);
+			m_size = static_cast<size_t>(status.st_size);
+		}
+	}
+	close(fd);
+#endif
+
+	// Fall back on reading the whole file where it can't be mapped.
+	if (!m_data)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+			throw std::runtime_error(std::format("Failed to open checkpoint file given path {}.", path));
+
+		m_buffer.resize(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		file.read(reinterpret_cast<char*>(m_buffer.data()), static_cast<std::streamsize>(m_buffer.size()));
+		m_data = m_buffer.data();
+		m_size = m_buffer.size();
+	}
+
+	// The destructor won't run to unmap the file if validating it throws.
+	try
+	{
+		if (m_size < sizeof(CheckpointHeader) || header().magic != CHECKPOINT_MAGIC)
+			throw std::runtime_error(std::format("{} is not a checkpoint file.", path));
+		if (header().byteOrderMark != CHECKPOINT_BYTE_ORDER_MARK)
+			throw std::runtime_error(std::format("Checkpoint {} was saved on a machine of a different byte order.",
+				path));
+		if (header().version != CHECKPOINT_VERSION)
+			throw std::runtime_error(std::format("Checkpoint {} is version {}, but only version {} can be restored.",
+				path, header().version, CHECKPOINT_VERSION));
+
+		bool truncated = header().parametersOffset + header().parametersSize > m_size;
+		for (const CheckpointHeader::Column& column : header().columns)
+			truncated |= column.offset + column.count * column.elementSize > m_size;
+		if (truncated)
+			throw std::runtime_error(std::format("Checkpoint {} is truncated.", path));
+
+		const CheckpointState& state = header().state;
+		if (state.integrator > static_cast<uint32_t>(Integrator::ForestRuth) || state.blockTimestepLevels < 1 ||
+			state.blockTimestepLevels > MAX_BLOCK_TIMESTEP_LEVELS)
+			throw std::runtime_error(std::format("Checkpoint {} has an invalid integrator or block timestep level count.",
+				path));
+
+		// Every column up to the tree's nodes has an element per body.
+		for (int i = 0; i < static_cast<int>(CheckpointColumn::TreeNodes); ++i)
+		{
+			if (header().columns[i].count != header().bodyCount)
+				throw std::runtime_error(std::format("Checkpoint {} has a column of the wrong length.", path));
+		}
+	}
+	catch (...)
+	{
+		unmap();
+		throw;
+	}
+}
+
+Checkpoint::~Checkpoint()
+{
+	unmap();
+}
+
+uint64_t Checkpoint::getBodyCount() const
+{
+	return header().bodyCount;
+}
+
+const CheckpointState& Checkpoint::getState() const
+{
+	return header().state;
+}
+
+uint32_t Checkpoint::getElementSize(const CheckpointColumn column) const
+{
+	return header().columns[static_cast<int>(column)].elementSize;
+}
+
+void Checkpoint::loadParameters() const
+{
+	std::istringstream parameters(std::string(reinterpret_cast<const char*>(m_data + header().parametersOffset),
+		header().parametersSize));
+	loadSimulationParameters(parameters);
+}
+
+void Checkpoint::unmap()
+{
+#ifdef GRAV_SIM_MMAP_CHECKPOINTS
+	if (m_buffer.empty() && m_data)
+		munmap(const_cast<std::byte*>(m_data), m_size);
+#endif
+	m_data = nullptr;
+}
+
+const CheckpointHeader& Checkpoint::header() const
+{
+	return *reinterpret_cast<const CheckpointHeader*>(m_data);
+}
@@ -0,0 +1,67 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#include "DirectSolver.hpp"
+
+#include <algorithm>
+#include <array>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+// Targets are summed in blocks of this many bodies, each going over the sources a tile at a time.
+static constexpr size_t DIRECT_TARGET_BLOCK_SIZE = 64;
+// Sources per tile. A tile is 24KiB in float and 48KiB in double, so it stays in L1 or L2 while every target in the
+// block is summed over it.
+static constexpr size_t DIRECT_SOURCE_TILE_SIZE = 2048;
+
+template <typename Real>
+DirectSolver<Real>::DirectSolver(const std::vector<Vec2_t<Real>>& positions, const std::vector<Real>& masses) :
+	m_positions(&positions), m_masses(&masses) { }
+
+template <typename Real>
+void DirectSolver<Real>::computeAccelerations(std::vector<Vec2_t<Real>>& accelerations,
+	const std::vector<uint8_t>* active)
+{
+	const std::vector<Vec2_t<Real>>& positions = *m_positions;
+	const size_t bodyCount = positions.size();
+	const auto params = ForceParams<Real>::fromGlobals();
+
+	accelerations.resize(bodyCount);
+
+	m_sources.xs.resize(bodyCount);
+	m_sources.ys.resize(bodyCount);
+	m_sources.masses.assign(m_masses->begin(), m_masses->end());
+	for (size_t i = 0; i < bodyCount; ++i)
+	{
+		m_sources.xs[i] = positions[i].x;
+		m_sources.ys[i] = positions[i].y;
+	}
+
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, bodyCount, DIRECT_TARGET_BLOCK_SIZE),
+		[&](const tbb::blocked_range<size_t>& range)
+		{
+			for (size_t blockBegin = range.begin(); blockBegin < range.end(); blockBegin += DIRECT_TARGET_BLOCK_SIZE)
+			{
+				const size_t blockEnd = std::min(blockBegin + DIRECT_TARGET_BLOCK_SIZE, range.end());
+				std::array<Vec2_t<Real>, DIRECT_TARGET_BLOCK_SIZE> accelSums = {};
+
+				for (size_t tileBegin = 0; tileBegin < bodyCount; tileBegin += DIRECT_SOURCE_TILE_SIZE)
+				{
+					const size_t tileCount = std::min(DIRECT_SOURCE_TILE_SIZE, bodyCount - tileBegin);
+
+					for (size_t i = blockBegin; i < blockEnd; ++i)
+						if (!active || (*active)[i])
+							accelSums[i - blockBegin] += bodyAccelSum(positions[i], &m_sources.xs[tileBegin],
+								&m_sources.ys[tileBegin], &m_sources.masses[tileBegin], tileCount, params);
+				}
+
+				for (size_t i = blockBegin; i < blockEnd; ++i)
+					if (!active || (*active)[i])
+						accelerations[i] = accelSums[i - blockBegin];
+			}
+		});
+}
+
+template class DirectSolver<float>;
+template class DirectSolver<double>;
@@ -0,0 +1,500 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#include "FMMSolver.hpp"
+
+#include <algorithm>
+#include <tbb/parallel_for.h>
+#include <tbb/task_group.h>
+
+// Subtrees with at most this many bodies are evaluated as one task each.
+static constexpr BodyIndex_t FMM_TASK_MAX_BODIES = 1024;
+// Subtrees with at most this many bodies are treated as leaves, getting their expansions straight from their bodies.
+// The quadtree's own leaves are sized for the tree walks, and are too small to be worth translating expansions between.
+static constexpr BodyIndex_t FMM_LEAF_MAX_BODIES = 128;
+// Node pairs with at most this many body pairs per expansion coefficient are summed directly, as that is cheaper than
+// translating the source's expansion.
+static constexpr BodyIndex_t FMM_DIRECT_PAIRS_PER_COEFF = 30;
+// The upward pass spawns a task per child down to this depth.
+static constexpr int FMM_PARALLEL_UPWARD_MAX_DEPTH = 4;
+
+// Coefficients are stored by total order, then by y power: (0, 0), (1, 0), (0, 1), (2, 0), (1, 1), (0, 2), ...
+static constexpr int coeffIndex(const int xPower, const int yPower)
+{
+	const int order = xPower + yPower;
+	return order * (order + 1) / 2 + yPower;
+}
+
+static constexpr std::array<double, 2 * MAX_FMM_ORDER + 1> FACTORIALS = []
+{
+	std::array<double, 2 * MAX_FMM_ORDER + 1> result = {};
+	result[0] = 1;
+	for (int i = 1; i < static_cast<int>(result.size()); ++i)
+		result[i] = result[i - 1] * i;
+	return result;
+}();
+
+// a! / (2^i i! (a - 2i)!), the coefficients of d^a/dx^a F(x^2 / 2 + c) = sum over i of x^(a - 2i) F^(a - i).
+static constexpr std::array<std::array<double, MAX_FMM_ORDER / 2 + 1>, MAX_FMM_ORDER + 1> HERMITE_COEFFS = []
+{
+	std::array<std::array<double, MAX_FMM_ORDER / 2 + 1>, MAX_FMM_ORDER + 1> result = {};
+	for (int a = 0; a <= MAX_FMM_ORDER; ++a)
+		for (int i = 0; 2 * i <= a; ++i)
+			result[a][i] = FACTORIALS[a] / (static_cast<double>(1 << i) * FACTORIALS[i] * FACTORIALS[a - 2 * i]);
+	return result;
+}();
+
+template <typename Real>
+FMMSolver<Real>::FMMSolver(const QuadTree<Real>& quadTree) : m_quadTree(&quadTree) { }
+
+template <typename Real>
+void FMMSolver<Real>::computeAccelerations(std::vector<Vec2_t<Real>>& accelerations,
+	const std::vector<uint8_t>* active)
+{
+	const QuadTree<Real>& tree = *m_quadTree;
+
+	accelerations.resize(tree.m_positions->size());
+	if (tree.m_nodes.empty())
+		return;
+
+	setOrder(g_fmmOrder);
+	m_params = ForceParams<Real>::fromGlobals();
+	m_sqrTheta = static_cast<double>(g_fmmTheta) * g_fmmTheta;
+
+	const size_t nodeCount = tree.m_nodes.size();
+	m_multipoles.resize(nodeCount * m_coeffCount);
+	m_locals.resize(nodeCount * m_coeffCount);
+	m_radii.resize(nodeCount);
+	m_bodyAccels.resize(tree.m_bodyMasses.size());
+
+	upwardPass(0, 0);
+	collectTaskNodes();
+
+	// Targets are only ever split within a task's subtree, so tasks never write to the same node or body. Nodes above
+	// the tasks get no local expansion; their far field is taken by the task nodes instead.
+	tbb::parallel_for(static_cast<size_t>(0), m_taskNodes.size(), [&](const size_t task)
+	{
+		const NodeIndex_t taskNode = m_taskNodes[task];
+		const auto [first, count] = tree.m_nodeBodyRanges[taskNode];
+
+		if (active && std::none_of(tree.m_indices.begin() + first, tree.m_indices.begin() + first + count,
+			[active](const BodyIndex_t index) { return (*active)[index]; }))
+			return;
+
+		std::fill(m_locals.begin() + taskNode * m_coeffCount,
+			m_locals.begin() + tree.m_nodes[taskNode].skip * m_coeffCount, 0.0);
+		std::fill(m_bodyAccels.begin() + first, m_bodyAccels.begin() + first + count, Vec2_t<Real>{});
+
+		interact(taskNode, 0);
+		downwardPass(taskNode);
+	});
+
+	tbb::parallel_for(static_cast<size_t>(0), m_bodyAccels.size(), [&](const size_t i)
+	{
+		const BodyIndex_t index = tree.m_indices[i];
+		if (!active || (*active)[index])
+			accelerations[index] = m_bodyAccels[i];
+	});
+}
+
+template <typename Real>
+void FMMSolver<Real>::setOrder(const int order)
+{
+	m_order = order;
+	m_coeffCount = (order + 1) * (order + 2) / 2;
+}
+
+template <typename Real>
+void FMMSolver<Real>::collectTaskNodes()
+{
+	const QuadTree<Real>& tree = *m_quadTree;
+	m_taskNodes.clear();
+
+	NodeIndex_t nodeIndex = 0;
+	while (nodeIndex < tree.m_nodes.size())
+	{
+		if (tree.isLeaf(nodeIndex) || tree.m_nodeBodyRanges[nodeIndex].count <= FMM_TASK_MAX_BODIES)
+		{
+			m_taskNodes.push_back(nodeIndex);
+			nodeIndex = tree.m_nodes[nodeIndex].skip;
+		}
+		else
+			++nodeIndex;
+	}
+}
+
+template <typename Real>
+bool FMMSolver<Real>::isLeaf(const NodeIndex_t nodeIndex) const
+{
+	return m_quadTree->isLeaf(nodeIndex) || m_quadTree->m_nodeBodyRanges[nodeIndex].count <= FMM_LEAF_MAX_BODIES;
+}
+
+template <typename Real>
+void FMMSolver<Real>::upwardPass(const NodeIndex_t nodeIndex, const int depth)
+{
+	const QuadTree<Real>& tree = *m_quadTree;
+
+	if (isLeaf(nodeIndex))
+	{
+		particlesToMultipole(nodeIndex);
+		return;
+	}
+
+	std::array<NodeIndex_t, 4> children;
+	int childCount = 0;
+
+	for (NodeIndex_t child = nodeIndex + 1; child < tree.m_nodes[nodeIndex].skip; child = tree.m_nodes[child].skip)
+		children[childCount++] = child;
+
+	if (depth < FMM_PARALLEL_UPWARD_MAX_DEPTH)
+	{
+		tbb::task_group group;
+
+		for (int child = 0; child < childCount; ++child)
+			group.run([this, &children, child, depth] { upwardPass(children[child], depth + 1); });
+
+		group.wait();
+	}
+	else
+	{
+		for (int child = 0; child < childCount; ++child)
+			upwardPass(children[child], depth + 1);
+	}
+
+	std::fill_n(m_multipoles.begin() + nodeIndex * m_coeffCount, m_coeffCount, 0.0);
+	m_radii[nodeIndex] = 0;
+
+	for (int child = 0; child < childCount; ++child)
+		multipoleToMultipole(children[child], nodeIndex);
+}
+
+template <typename Real>
+void FMMSolver<Real>::interact(const NodeIndex_t target, const NodeIndex_t source)
+{
+	const QuadTree<Real>& tree = *m_quadTree;
+
+	if (tree.m_nodeBodyRanges[target].count * tree.m_nodeBodyRanges[source].count <=
+		FMM_DIRECT_PAIRS_PER_COEFF * static_cast<BodyIndex_t>(m_coeffCount))
+	{
+		particlesToParticles(source, target);
+		return;
+	}
+
+	const glm::dvec2 rel = glm::dvec2(tree.m_nodes[target].com.position) - glm::dvec2(tree.m_nodes[source].com.position);
+	const double radiusSum = m_radii[target] + m_radii[source];
+
+	// Both nodes fit well inside a circle of their separation, so the source's expansion converges over the target.
+	if (radiusSum * radiusSum < m_sqrTheta * glm::dot(rel, rel))
+	{
+		multipoleToLocal(source, target);
+		return;
+	}
+
+	const bool targetIsLeaf = isLeaf(target);
+	const bool sourceIsLeaf = isLeaf(source);
+
+	if (targetIsLeaf && sourceIsLeaf)
+		particlesToParticles(source, target);
+	// Split whichever node is larger.
+	else if (sourceIsLeaf || (!targetIsLeaf && m_radii[target] >= m_radii[source]))
+	{
+		for (NodeIndex_t child = target + 1; child < tree.m_nodes[target].skip; child = tree.m_nodes[child].skip)
+			interact(child, source);
+	}
+	else
+	{
+		for (NodeIndex_t child = source + 1; child < tree.m_nodes[source].skip; child = tree.m_nodes[child].skip)
+			interact(target, child);
+	}
+}
+
+template <typename Real>
+void FMMSolver<Real>::downwardPass(const NodeIndex_t nodeIndex)
+{
+	const QuadTree<Real>& tree = *m_quadTree;
+
+	if (isLeaf(nodeIndex))
+	{
+		localToParticles(nodeIndex);
+		return;
+	}
+
+	for (NodeIndex_t child = nodeIndex + 1; child < tree.m_nodes[nodeIndex].skip; child = tree.m_nodes[child].skip)
+	{
+		localToLocal(nodeIndex, child);
+		downwardPass(child);
+	}
+}
+
+template <typename Real>
+void FMMSolver<Real>::particlesToMultipole(const NodeIndex_t nodeIndex)
+{
+	const QuadTree<Real>& tree = *m_quadTree;
+	const auto center = glm::dvec2(tree.m_nodes[nodeIndex].com.position);
+	const auto [first, count] = tree.m_nodeBodyRanges[nodeIndex];
+
+	double* multipole = &m_multipoles[nodeIndex * m_coeffCount];
+	std::fill_n(multipole, m_coeffCount, 0.0);
+
+	double radius = 0;
+	Coeffs_t powers;
+
+	for (BodyIndex_t i = first; i < first + count; ++i)
+	{
+		const glm::dvec2 offset = glm::dvec2(tree.bodyPosition(i)) - center;
+		const double mass = tree.m_bodyMasses[i];
+
+		scaledPowers(offset, m_order, powers);
+		for (int k = 0; k < m_coeffCount; ++k)
+			multipole[k] += mass * powers[k];
+
+		radius = std::max(radius, glm::length(offset));
+	}
+
+	m_radii[nodeIndex] = radius;
+}
+
+template <typename Real>
+void FMMSolver<Real>::multipoleToMultipole(const NodeIndex_t child, const NodeIndex_t parent)
+{
+	const QuadTree<Real>& tree = *m_quadTree;
+	const glm::dvec2 shift = glm::dvec2(tree.m_nodes[child].com.position) -
+		glm::dvec2(tree.m_nodes[parent].com.position);
+
+	const double* childMultipole = &m_multipoles[child * m_coeffCount];
+	double* parentMultipole = &m_multipoles[parent * m_coeffCount];
+
+	Coeffs_t powers;
+	scaledPowers(shift, m_order, powers);
+
+	// M_parent(k) = sum over j <= k of M_child(j) shift^(k - j) / (k - j)!
+	for (int order = 0; order <= m_order; ++order)
+	{
+		for (int ky = 0; ky <= order; ++ky)
+		{
+			const int kx = order - ky;
+			double sum = 0;
+
+			for (int jx = 0; jx <= kx; ++jx)
+				for (int jy = 0; jy <= ky; ++jy)
+					sum += childMultipole[coeffIndex(jx, jy)] * powers[coeffIndex(kx - jx, ky - jy)];
+
+			parentMultipole[coeffIndex(kx, ky)] += sum;
+		}
+	}
+
+	m_radii[parent] = std::max(m_radii[parent], m_radii[child] + glm::length(shift));
+}
+
+template <typename Real>
+void FMMSolver<Real>::multipoleToLocal(const NodeIndex_t source, const NodeIndex_t target)
+{
+	const QuadTree<Real>& tree = *m_quadTree;
+	const glm::dvec2 rel = glm::dvec2(tree.m_nodes[target].com.position) - glm::dvec2(tree.m_nodes[source].com.position);
+
+	const double* multipole = &m_multipoles[source * m_coeffCount];
+	double* local = &m_locals[target * m_coeffCount];
+
+	Coeffs_t derivatives;
+	kernelDerivatives(rel, derivatives);
+
+	// L(n) = sum over k of (-1)^|k| M(k) D(n + k), truncated to |n + k| <= order. The monopole term L(0, 0) is the
+	// potential itself, which is never needed. Each k is scattered over every n it reaches, as for given orders of n and
+	// k, the coefficients of n and of n + k are both contiguous.
+	Coeffs_t sums = {};
+
+	for (int kOrder = 0; kOrder < m_order; ++kOrder)
+	{
+		const double sign = kOrder % 2 == 0 ? 1.0 : -1.0;
+
+		for (int ky = 0; ky <= kOrder; ++ky)
+		{
+			const double coeff = sign * multipole[coeffIndex(kOrder - ky, ky)];
+
+			for (int nOrder = 1; nOrder <= m_order - kOrder; ++nOrder)
+			{
+				double* nSums = sums.data() + coeffIndex(nOrder, 0);
+				const double* sumDerivatives = derivatives.data() + coeffIndex(nOrder + kOrder, 0) + ky;
+
+				for (int ny = 0; ny <= nOrder; ++ny)
+					nSums[ny] += coeff * sumDerivatives[ny];
+			}
+		}
+	}
+
+	for (int k = 1; k < m_coeffCount; ++k)
+		local[k] += sums[k];
+}
+
+template <typename Real>
+void FMMSolver<Real>::localToLocal(const NodeIndex_t parent, const NodeIndex_t child)
+{
+	const QuadTree<Real>& tree = *m_quadTree;
+	const glm::dvec2 shift = glm::dvec2(tree.m_nodes[child].com.position) -
+		glm::dvec2(tree.m_nodes[parent].com.position);
+
+	const double* parentLocal = &m_locals[parent * m_coeffCount];
+	double* childLocal = &m_locals[child * m_coeffCount];
+
+	Coeffs_t powers;
+	scaledPowers(shift, m_order, powers);
+
+	// L_child(n) = sum over k of L_parent(n + k) shift^k / k!
+	for (int nOrder = 1; nOrder <= m_order; ++nOrder)
+	{
+		for (int ny = 0; ny <= nOrder; ++ny)
+		{
+			const int nx = nOrder - ny;
+			double sum = 0;
+
+			for (int kOrder = 0; kOrder <= m_order - nOrder; ++kOrder)
+			{
+				for (int ky = 0; ky <= kOrder; ++ky)
+				{
+					const int kx = kOrder - ky;
+					sum += parentLocal[coeffIndex(nx + kx, ny + ky)] * powers[coeffIndex(kx, ky)];
+				}
+			}
+
+			childLocal[coeffIndex(nx, ny)] += sum;
+		}
+	}
+}
+
+template <typename Real>
+void FMMSolver<Real>::localToParticles(const NodeIndex_t nodeIndex)
+{
+	const QuadTree<Real>& tree = *m_quadTree;
+	const auto center = glm::dvec2(tree.m_nodes[nodeIndex].com.position);
+	const auto [first, count] = tree.m_nodeBodyRanges[nodeIndex];
+
+	const double* local = &m_locals[nodeIndex * m_coeffCount];
+	Coeffs_t powers;
+
+	for (BodyIndex_t i = first; i < first + count; ++i)
+	{
+		scaledPowers(glm::dvec2(tree.bodyPosition(i)) - center, m_order - 1, powers);
+
+		// Acceleration is minus the gradient of the potential, whose x derivative shifts each coefficient by (1, 0).
+		glm::dvec2 gradient = {};
+
+		for (int order = 0; order < m_order; ++order)
+		{
+			for (int y = 0; y <= order; ++y)
+			{
+				const int x = order - y;
+				const double power = powers[coeffIndex(x, y)];
+
+				gradient.x += local[coeffIndex(x + 1, y)] * power;
+				gradient.y += local[coeffIndex(x, y + 1)] * power;
+			}
+		}
+
+		m_bodyAccels[i] += Vec2_t<Real>(-static_cast<double>(m_params.gravConst) * gradient);
+	}
+}
+
+template <typename Real>
+void FMMSolver<Real>::particlesToParticles(const NodeIndex_t source, const NodeIndex_t target)
+{
+	const QuadTree<Real>& tree = *m_quadTree;
+	const auto [sourceFirst, sourceCount] = tree.m_nodeBodyRanges[source];
+	const auto [targetFirst, targetCount] = tree.m_nodeBodyRanges[target];
+
+	// Node body ranges cover their whole subtrees. A body sees itself when a node interacts with itself, and is
+	// discarded by the kernel's epsilon.
+	for (BodyIndex_t i = targetFirst; i < targetFirst + targetCount; ++i)
+		m_bodyAccels[i] += bodyAccelSum(tree.bodyPosition(i), &tree.m_bodyXs[sourceFirst], &tree.m_bodyYs[sourceFirst],
+			&tree.m_bodyMasses[sourceFirst], sourceCount, m_params);
+}
+
+template <typename Real>
+void FMMSolver<Real>::kernelDerivatives(const glm::dvec2 rel, Coeffs_t& derivatives) const
+{
+	// The kernel is psi(r) with psi'(r) = 1 / (GRAVSMOOTHNESS + r^2), written as F(u) with u = r^2 / 2. Then
+	// F^(m)(u) = (1/r d/dr)^m psi, and F'(u) = w^-1/2 (GRAVSMOOTHNESS + w)^-1 with w = r^2, so each higher derivative
+	// follows from the Leibniz rule on those two powers of w.
+	const double sqrDist = glm::dot(rel, rel);
+	const double invSqrDist = 1.0 / sqrDist;
+	const double invSoftSqrDist = 1.0 / (m_params.gravSmoothness + sqrDist);
+
+	std::array<double, MAX_FMM_ORDER> powerDerivatives;
+	std::array<double, MAX_FMM_ORDER> softDerivatives;
+	powerDerivatives[0] = std::sqrt(invSqrDist);
+	softDerivatives[0] = invSoftSqrDist;
+
+	for (int k = 1; k < m_order; ++k)
+	{
+		powerDerivatives[k] = powerDerivatives[k - 1] * (-0.5 - (k - 1)) * invSqrDist;
+		softDerivatives[k] = softDerivatives[k - 1] * -k * invSoftSqrDist;
+	}
+
+	std::array<double, MAX_FMM_ORDER + 1> radialDerivatives = {};
+	double twoPower = 1;
+
+	for (int m = 1; m <= m_order; ++m)
+	{
+		double sum = 0;
+		for (int k = 0; k < m; ++k)
+			sum += FACTORIALS[m - 1] / (FACTORIALS[k] * FACTORIALS[m - 1 - k]) *
+				powerDerivatives[k] * softDerivatives[m - 1 - k];
+
+		radialDerivatives[m] = twoPower * sum;
+		twoPower *= 2;
+	}
+
+	std::array<double, MAX_FMM_ORDER + 1> xPowers;
+	std::array<double, MAX_FMM_ORDER + 1> yPowers;
+	xPowers[0] = yPowers[0] = 1;
+
+	for (int i = 1; i <= m_order; ++i)
+	{
+		xPowers[i] = xPowers[i - 1] * rel.x;
+		yPowers[i] = yPowers[i - 1] * rel.y;
+	}
+
+	derivatives[0] = 0;
+
+	for (int order = 1; order <= m_order; ++order)
+	{
+		for (int b = 0; b <= order; ++b)
+		{
+			const int a = order - b;
+			double sum = 0;
+
+			// Derivatives in x and y separate, as F's argument is a sum of a term in each.
+			for (int i = 0; 2 * i <= a; ++i)
+			{
+				double ySum = 0;
+				for (int j = 0; 2 * j <= b; ++j)
+					ySum += HERMITE_COEFFS[b][j] * yPowers[b - 2 * j] * radialDerivatives[order - i - j];
+
+				sum += HERMITE_COEFFS[a][i] * xPowers[a - 2 * i] * ySum;
+			}
+
+			derivatives[coeffIndex(a, b)] = sum;
+		}
+	}
+}
+
+template <typename Real>
+void FMMSolver<Real>::scaledPowers(const glm::dvec2 rel, const int order, Coeffs_t& powers)
+{
+	std::array<double, MAX_FMM_ORDER + 1> xPowers;
+	std::array<double, MAX_FMM_ORDER + 1> yPowers;
+	xPowers[0] = yPowers[0] = 1;
+
+	for (int i = 1; i <= order; ++i)
+	{
+		xPowers[i] = xPowers[i - 1] * rel.x / i;
+		yPowers[i] = yPowers[i - 1] * rel.y / i;
+	}
+
+	for (int total = 0; total <= order; ++total)
+		for (int y = 0; y <= total; ++y)
+			powers[coeffIndex(total - y, y)] = xPowers[total - y] * yPowers[y];
+}
+
+template class FMMSolver<float>;
+template class FMMSolver<double>;
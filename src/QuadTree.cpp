@@ -5,32 +5,48 @@
 #include "QuadTree.hpp"
 
 #include <algorithm>
+#include <execution>
 #include <iostream>
 #include <numeric>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/norm.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_group.h>
+
+#include "gravity.hpp"
+#include "Timings.hpp"
 
 static constexpr long double QUADTREE_RESERVE_MULTIPLIER = 2.5L;
-static constexpr float PRECOMPUTED_BOUNDS_MIN_SIZE = 1.0f;
+// Nodes with at least this many bodies are partitioned in parallel and have their children built as parallel tasks.
+// Below this the task overhead outweighs the work.
+static constexpr long PARALLEL_BUILD_MIN_BODIES = 4096;
+// Nodes this deep are always leaves, however many bodies they hold.
+static constexpr int MAX_TREE_DEPTH = 24;
+// Refits spawn a task per child down to this depth.
+static constexpr int PARALLEL_REFIT_MAX_DEPTH = 4;
+
+// Morton keys interleave this many bits of each axis, so the key-prefix builder can descend this many levels before
+// handing what's left over to the partition builder.
+static constexpr int MORTON_BITS_PER_AXIS = 16;
+static constexpr int RADIX_SORT_DIGIT_BITS = 8;
+static constexpr int RADIX_SORT_BUCKETS = 1 << RADIX_SORT_DIGIT_BITS;
+static constexpr uint32_t RADIX_SORT_DIGIT_MASK = RADIX_SORT_BUCKETS - 1;
+static constexpr size_t RADIX_SORT_MIN_CHUNK_SIZE = 16384;
 
 static constexpr Color QUADTREE_VIS_FILL_COLOR = {0, 255, 255, 5};
 static constexpr Color QUADTREE_VIS_OUTLINE_COLOR = {255, 255, 255, 50};
 static constexpr Color QUADTREE_VIS_LEAF_OUTLINE_COLOR = RED;
 static constexpr float QUADTREE_VIS_LINE_THICKNESS = 1.0f;
 
-static constexpr float SQR_DIST_EPSILON = 0.1f;
-
-QuadTree::QuadTree(const std::vector<glm::vec2>& positions, const std::vector<float>& masses)
+template <typename Real>
+QuadTree<Real>::QuadTree(const std::vector<Vec2_t<Real>>& positions, const std::vector<Real>& masses)
 	: m_positions(&positions), m_masses(&masses) { }
 
-void QuadTree::buildTree()
+template <typename Real>
+void QuadTree<Real>::buildTree()
 {
-	m_nodes.clear();
-	m_nodeCoMs.clear();
-	m_nodeBodyIndices.clear();
-	m_nodeIsLeaf.clear();
-	m_precomputedBoundsSizes.clear();
-	m_nodeCounter = 0;
+	m_stepsSinceRebuild = 0;
 	m_boundsSize = 0;
 	m_boundsCenter = {};
 
@@ -38,222 +54,804 @@ void QuadTree::buildTree()
 	{
 		m_indices.resize(m_positions->size());
 		std::iota(m_indices.begin(), m_indices.end(), 0);
+		m_bodyXs.resize(m_indices.size());
+		m_bodyYs.resize(m_indices.size());
+		m_bodyMasses.resize(m_indices.size());
 	}
 
+	// The arena keeps its nodes between builds and only ever grows, as every node claimed gets fully overwritten.
 	const auto reserveSize = static_cast<size_t>(QUADTREE_RESERVE_MULTIPLIER * m_positions->size());
-	m_nodes.resize(reserveSize);
-	m_nodeCoMs.resize(reserveSize);
-	m_nodeBodyIndices.resize(reserveSize);
-	m_nodeIsLeaf.resize(reserveSize);
+	if (m_buildNodes.size() < reserveSize)
+		m_buildNodes.resize(reserveSize);
+
+	{
+		ScopedTimer timer(TimingPhase::TreeBounds);
+		calculateBoundingSquare();
+	}
+
+	if (g_treeBuilder == TreeBuilder::Morton)
+	{
+		ScopedTimer timer(TimingPhase::TreeSort);
+		sortByMortonKey();
+	}
+
+	NodeIndex_t root;
+	{
+		ScopedTimer timer(TimingPhase::TreeNodes);
+		root = buildRoot();
+
+		// Nodes claimed past the end of the arena weren't built. Grow it and try again.
+		while (m_nodeCounter.load(std::memory_order_relaxed) > m_buildNodes.size())
+		{
+			m_buildNodes.resize(std::max<size_t>(2 * m_buildNodes.size(),
+				m_nodeCounter.load(std::memory_order_relaxed)));
+			root = buildRoot();
+		}
+	}
 
-	calculateBoundingSquare();
+	ScopedTimer timer(TimingPhase::TreeLayout);
 
-	buildTree(m_indices.begin(), m_indices.end(), m_boundsSize, m_boundsCenter);
+	// Resizing rather than clearing keeps the capacity, and every node kept is overwritten by the layout.
+	const NodeIndex_t nodeCount = root == NULL_INDEX ? 0 : m_nodeCounter.load(std::memory_order_relaxed);
+	m_nodes.resize(nodeCount);
+	m_nodeBodyRanges.resize(nodeCount);
+	m_nodeCells.resize(nodeCount);
 
-	float precomputedBoundsSize = m_boundsSize;
-	while (precomputedBoundsSize > PRECOMPUTED_BOUNDS_MIN_SIZE)
+	if (root != NULL_INDEX)
+		layoutDepthFirst(root, 0);
+
+	collectGroups();
+}
+
+template <typename Real>
+bool QuadTree<Real>::updateTree()
+{
+	if (m_nodeCounter.load(std::memory_order_relaxed) == 0 || ++m_stepsSinceRebuild >= g_treeRebuildInterval)
 	{
-		m_precomputedBoundsSizes.push_back(precomputedBoundsSize);
-		precomputedBoundsSize /= 2;
+		buildTree();
+		return true;
 	}
+
+	// Bodies have drifted too far from the cells they were assigned to for the old topology to be worth keeping.
+	bool degraded;
+	{
+		ScopedTimer timer(TimingPhase::TreeRefit);
+		const RefitResult result = m_nodes.empty() ? RefitResult{} : refitTree(0, 0);
+		degraded = result.weight > 0 && result.weightedGrowth / result.weight > g_treeRefitMaxGrowth;
+	}
+
+	if (degraded)
+	{
+		buildTree();
+		return true;
+	}
+
+	return false;
 }
 
-const std::vector<BodyIndex_t>& QuadTree::getIndices() const
+template <typename Real>
+bool QuadTree<Real>::rebuildDue() const
+{
+	return m_nodeCounter.load(std::memory_order_relaxed) == 0 || m_stepsSinceRebuild + 1 >= g_treeRebuildInterval;
+}
+
+template <typename Real>
+void QuadTree<Real>::onBodiesReordered()
+{
+	// Tree order is unchanged, the bodies are just where it says they are now.
+	std::iota(m_indices.begin(), m_indices.end(), 0);
+}
+
+template <typename Real>
+const std::vector<BodyIndex_t>& QuadTree<Real>::getIndices() const
 {
 	return m_indices;
 }
 
-glm::vec2 QuadTree::getSystemCoMPosition() const
+template <typename Real>
+void QuadTree<Real>::getCheckpointColumns(std::array<CheckpointColumnData, CHECKPOINT_COLUMN_COUNT>& columns) const
+{
+	columns[static_cast<int>(CheckpointColumn::TreeIndices)] =
+		{m_indices.data(), m_indices.size(), sizeof(BodyIndex_t)};
+	columns[static_cast<int>(CheckpointColumn::TreeNodes)] = {m_nodes.data(), m_nodes.size(), sizeof(Node)};
+	columns[static_cast<int>(CheckpointColumn::TreeNodeBodyRanges)] =
+		{m_nodeBodyRanges.data(), m_nodeBodyRanges.size(), sizeof(BodyRange)};
+	columns[static_cast<int>(CheckpointColumn::TreeNodeCells)] =
+		{m_nodeCells.data(), m_nodeCells.size(), sizeof(NodeCell)};
+}
+
+template <typename Real>
+uint32_t QuadTree<Real>::getStepsSinceRebuild() const
+{
+	return static_cast<uint32_t>(m_stepsSinceRebuild);
+}
+
+template <typename Real>
+bool QuadTree<Real>::restore(const Checkpoint& checkpoint)
 {
-	return m_nodeCoMs[0].position;
+	if (checkpoint.getElementSize(CheckpointColumn::TreeNodes) != sizeof(Node) ||
+		checkpoint.getElementSize(CheckpointColumn::TreeNodeCells) != sizeof(NodeCell))
+		return false;
+
+	checkpoint.readColumn(CheckpointColumn::TreeIndices, m_indices);
+	checkpoint.readColumn(CheckpointColumn::TreeNodes, m_nodes);
+	checkpoint.readColumn(CheckpointColumn::TreeNodeBodyRanges, m_nodeBodyRanges);
+	checkpoint.readColumn(CheckpointColumn::TreeNodeCells, m_nodeCells);
+
+	if (m_nodeBodyRanges.size() != m_nodes.size() || m_nodeCells.size() != m_nodes.size())
+		throw std::runtime_error("Checkpoint has a quadtree with columns of different lengths.");
+	if (m_nodes.empty())
+		return false;
+
+	m_nodeCounter.store(static_cast<NodeIndex_t>(m_nodes.size()), std::memory_order_relaxed);
+	m_stepsSinceRebuild = static_cast<int>(checkpoint.getState().stepsSinceRebuild);
+
+	// The tree order copies were last filled from these same positions.
+	m_bodyXs.resize(m_indices.size());
+	m_bodyYs.resize(m_indices.size());
+	m_bodyMasses.resize(m_indices.size());
+	tbb::parallel_for(static_cast<size_t>(0), m_indices.size(), [this](const size_t i)
+	{
+		m_bodyXs[i] = (*m_positions)[m_indices[i]].x;
+		m_bodyYs[i] = (*m_positions)[m_indices[i]].y;
+		m_bodyMasses[i] = (*m_masses)[m_indices[i]];
+	});
+
+	collectGroups();
+	return true;
 }
 
-glm::vec2 QuadTree::accelAt(const glm::vec2 position) const
+template <typename Real>
+Vec2_t<Real> QuadTree<Real>::getSystemCoMPosition() const
 {
-	return accelAt(position, 0, 0);
+	return m_nodes[0].com.position;
 }
 
-void QuadTree::visualize(const float cameraZoom) const
+template <typename Real>
+template <typename Law>
+Vec2_t<Real> QuadTree<Real>::accelAt(const Vec2_t<Real> position, const ForceParams<Real> params) const
 {
-	const float halfSize = m_boundsSize / 2.0f;
-	visualize(0,
-		{m_boundsCenter.x - halfSize, m_boundsCenter.y - halfSize, m_boundsSize, m_boundsSize},
-		cameraZoom);
+	Vec2_t<Real> accelSum = {};
+	NodeIndex_t nodeIndex = 0;
+	const auto nodeCount = static_cast<NodeIndex_t>(m_nodes.size());
+
+	// Nodes are laid out depth-first, so a node's first child directly follows it and its skip index is the next node
+	// after its subtree. Each node either gets accepted and skipped past, or opened by moving on to its first child.
+	while (nodeIndex < nodeCount)
+	{
+		const Node& node = m_nodes[nodeIndex];
+		const CoM<Real>& com = node.com;
+		const Vec2_t<Real> rel = com.position - position;
+		const Real sqrDist = glm::length2(rel);
+
+		// Decide whether to approximate gravitational field using the Barnes-Hut heuristic. Multiplied out rather
+		// than divided so that a node whose CoM is at position is never approximated.
+		if (node.sqrSize < params.sqrTheta * sqrDist)
+		{
+			// Prevent NaNs/infs, discarding the node like gravAccel would its bodies.
+			if (sqrDist > SQR_DIST_EPSILON)
+				accelSum += nodeGravAccel<Law>(rel, sqrDist, com, params);
+
+			nodeIndex = node.skip;
+		}
+		// If leaf node, sum its bodies directly. The body at position itself is discarded by gravAccel's epsilon.
+		else if (isLeaf(nodeIndex))
+		{
+			const auto [first, count] = m_nodeBodyRanges[nodeIndex];
+
+			// Too few bodies for the batched kernels to pay off.
+			for (BodyIndex_t i = first; i < first + count; ++i)
+				accelSum += gravAccel<Law>(position, bodyPosition(i), m_bodyMasses[i], params);
+
+			nodeIndex = node.skip;
+		}
+		// Otherwise, descend.
+		else
+			++nodeIndex;
+	}
+
+	return accelSum;
 }
 
-void QuadTree::calculateBoundingSquare()
+template <typename Real>
+void QuadTree<Real>::computeAccelerations(std::vector<Vec2_t<Real>>& accelerations,
+	const std::vector<uint8_t>* active) const
 {
-	glm::vec2 min = {INFINITY, INFINITY};
-	glm::vec2 max = {-INFINITY, -INFINITY};
+	accelerations.resize(m_positions->size());
+	const auto params = ForceParams<Real>::fromGlobals();
 
-	for (const auto& position : *m_positions)
+	if (g_forceTraversal == ForceTraversal::Body)
 	{
-		if (position.x < min.x)
-			min.x = position.x;
-		if (position.x > max.x)
-			max.x = position.x;
-		if (position.y < min.y)
-			min.y = position.y;
-		if (position.y > max.y)
-			max.y = position.y;
+		withForceLaw(params, [&]<typename Law>()
+		{
+			std::for_each(std::execution::par_unseq, m_indices.begin(), m_indices.end(),
+				[&](const BodyIndex_t index)
+				{
+					if (!active || (*active)[index])
+						accelerations[index] = accelAt<Law>((*m_positions)[index], params);
+				});
+		});
+
+		return;
 	}
 
-	const float width = max.x - min.x;
-	const float height = max.y - min.y;
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, m_groupNodes.size()),
+		[&](const tbb::blocked_range<size_t>& range)
+		{
+			// Reused across the groups in this range to avoid reallocating.
+			NodeSources<Real> sourceNodes;
+			BodySources<Real> sourceBodies;
 
-	m_boundsSize = std::max(width, height);
-	m_boundsCenter =  min + (max - min) / 2.0f;
+			for (size_t group = range.begin(); group != range.end(); ++group)
+				accelerationsForGroup(m_groupNodes[group], params, active, sourceNodes, sourceBodies, accelerations);
+		});
 }
 
-NodeIndex_t QuadTree::buildTree(const IndexIt_t begin, const IndexIt_t end, const float size, const glm::vec2 center)
+template <typename Real>
+void QuadTree<Real>::collectCells(std::vector<QuadTreeCell>& cells) const
 {
-	// Exit if range empty.
-	if (begin == end)
-		return NULL_INDEX;
+	// Depth-first order puts parents before their children.
+	cells.resize(m_nodes.size());
+	for (NodeIndex_t nodeIndex = 0; nodeIndex < m_nodes.size(); ++nodeIndex)
+	{
+		const auto [center, size] = m_nodeCells[nodeIndex];
+		cells[nodeIndex] = {glm::vec2(center), static_cast<float>(size), isLeaf(nodeIndex)};
+	}
+}
 
-	const NodeIndex_t result = m_nodeCounter++;
-	CoM& com = m_nodeCoMs[result];
-	const long nodeLength = end - begin;
+template <typename Real>
+void QuadTree<Real>::visualize(const std::vector<QuadTreeCell>& cells, const float cameraZoom)
+{
+	for (const auto [center, size, leaf] : cells)
+	{
+		const Rectangle rect = {center.x - size / 2, center.y - size / 2, size, size};
+
+		DrawRectangleRec(rect, QUADTREE_VIS_FILL_COLOR);
+		DrawRectangleLinesEx(rect, QUADTREE_VIS_LINE_THICKNESS / cameraZoom,
+			leaf ? QUADTREE_VIS_LEAF_OUTLINE_COLOR : QUADTREE_VIS_OUTLINE_COLOR);
+	}
+}
 
-	// Calculate CoM of node.
-	glm::vec2 momentSum = {};
-	float massSum = 0;
+template <typename Real>
+void QuadTree<Real>::collectGroups()
+{
+	m_groupNodes.clear();
 
-	for (auto it = begin; it != end; ++it)
+	NodeIndex_t nodeIndex = 0;
+	while (nodeIndex < m_nodes.size())
 	{
-		const float mass = (*m_masses)[*it];
-		momentSum += (*m_positions)[*it] * mass;
-		massSum += mass;
+		if (isLeaf(nodeIndex) || m_nodeBodyRanges[nodeIndex].count <= static_cast<BodyIndex_t>(g_groupSize))
+		{
+			m_groupNodes.push_back(nodeIndex);
+			nodeIndex = m_nodes[nodeIndex].skip;
+		}
+		else
+			++nodeIndex;
 	}
+}
 
-	com.position = momentSum / massSum;
-	com.mass = massSum;
+template <typename Real>
+void QuadTree<Real>::accelerationsForGroup(const NodeIndex_t groupNode, const ForceParams<Real> params,
+	const std::vector<uint8_t>* active, NodeSources<Real>& sourceNodes, BodySources<Real>& sourceBodies,
+	std::vector<Vec2_t<Real>>& accelerations) const
+{
+	const auto [groupFirst, groupCount] = m_nodeBodyRanges[groupNode];
+
+	// Inactive groups skip the walk entirely.
+	if (active && std::none_of(m_indices.begin() + groupFirst, m_indices.begin() + groupFirst + groupCount,
+		[active](const BodyIndex_t index) { return (*active)[index]; }))
+		return;
+
+	Bounds groupBounds;
+	for (BodyIndex_t i = groupFirst; i < groupFirst + groupCount; ++i)
+		groupBounds = groupBounds.merge({bodyPosition(i), bodyPosition(i)});
+
+	sourceNodes.clear();
+	sourceBodies.clear();
+
+	// Same walk as accelAt, but the opening criterion uses the distance from a node's CoM to the nearest point of the
+	// group's bounds, so a node accepted here would have been accepted by every body in the group.
+	NodeIndex_t nodeIndex = 0;
+	const auto nodeCount = static_cast<NodeIndex_t>(m_nodes.size());
 
-	// Leaf node.
-	if (nodeLength == 1)
+	while (nodeIndex < nodeCount)
 	{
-		m_nodeBodyIndices[result] = *begin;
-		m_nodeIsLeaf[result] = true;
-		return result;
+		const Node& node = m_nodes[nodeIndex];
+		const CoM<Real>& com = node.com;
+		const Vec2_t<Real> gap = glm::max(glm::max(groupBounds.min - com.position, com.position - groupBounds.max),
+			Vec2_t<Real>{0, 0});
+		const Real sqrDist = glm::length2(gap);
+
+		if (node.sqrSize < params.sqrTheta * sqrDist)
+		{
+			sourceNodes.push_back(com);
+			nodeIndex = node.skip;
+		}
+		else if (isLeaf(nodeIndex))
+		{
+			const auto [first, count] = m_nodeBodyRanges[nodeIndex];
+			sourceBodies.append(&m_bodyXs[first], &m_bodyYs[first], &m_bodyMasses[first], count);
+			nodeIndex = node.skip;
+		}
+		else
+			++nodeIndex;
 	}
 
-	// Partition bodies into quadrants and recurse.
-	m_nodeBodyIndices[result] = NULL_INDEX;
-	m_nodeIsLeaf[result] = false;
+	// Every body in the group sees the same sources. Each body itself is among them, and is discarded by the kernels'
+	// epsilon.
+	for (BodyIndex_t i = groupFirst; i < groupFirst + groupCount; ++i)
+	{
+		if (active && !(*active)[m_indices[i]])
+			continue;
 
-	auto top  = [this, center](const BodyIndex_t index) { return (*m_positions)[index].y < center.y; };
-	auto left = [this, center](const BodyIndex_t index) { return (*m_positions)[index].x < center.x; };
+		const Vec2_t<Real> position = bodyPosition(i);
+		const Vec2_t<Real> accelSum = nodeAccelSum(position, sourceNodes, params) +
+			bodyAccelSum(position, sourceBodies, params);
+
+		accelerations[m_indices[i]] = accelSum;
+	}
+}
+
+template <typename Real>
+void QuadTree<Real>::calculateBoundingSquare()
+{
+	const auto [min, max] = std::transform_reduce(std::execution::par_unseq,
+		m_positions->begin(), m_positions->end(),
+		Bounds{{INFINITY, INFINITY}, {-INFINITY, -INFINITY}},
+		[](const Bounds& a, const Bounds& b) { return a.merge(b); },
+		[](const Vec2_t<Real> position) -> Bounds { return {position, position}; });
+
+	const Real width = max.x - min.x;
+	const Real height = max.y - min.y;
+
+	m_boundsSize = std::max(width, height);
+	m_boundsCenter =  min + (max - min) / static_cast<Real>(2);
+}
+
+// Spreads the low 16 bits of value out to the even bits of the result.
+static uint32_t spreadBits(uint32_t value)
+{
+	value &= 0x0000ffff;
+	value = (value | value << 8) & 0x00ff00ff;
+	value = (value | value << 4) & 0x0f0f0f0f;
+	value = (value | value << 2) & 0x33333333;
+	value = (value | value << 1) & 0x55555555;
+	return value;
+}
+
+// Each pair of key bits is the quadrant at one level, ordered the same as a node's children: top before bottom, then
+// left before right.
+template <typename Real>
+static uint32_t mortonKey(const Vec2_t<Real> position, const Vec2_t<Real> origin, const Real scale)
+{
+	static constexpr Real MAX_COORD = (1 << MORTON_BITS_PER_AXIS) - 1;
+
+	const Vec2_t<Real> scaled = (position - origin) * scale;
+	const auto x = static_cast<uint32_t>(std::clamp<Real>(scaled.x, 0, MAX_COORD));
+	const auto y = static_cast<uint32_t>(std::clamp<Real>(scaled.y, 0, MAX_COORD));
+
+	return spreadBits(x) | spreadBits(y) << 1;
+}
+
+// Stable LSD radix sort of keys, carrying values along. Each pass counts digits per chunk in parallel, prefix sums the
+// counts and then scatters each chunk in parallel.
+static void radixSortByKey(std::vector<uint32_t>& keys, std::vector<BodyIndex_t>& values,
+	std::vector<uint32_t>& keysScratch, std::vector<BodyIndex_t>& valuesScratch)
+{
+	const size_t size = keys.size();
+	keysScratch.resize(size);
+	valuesScratch.resize(size);
+
+	const size_t chunkCount = std::max<size_t>(1, size / RADIX_SORT_MIN_CHUNK_SIZE);
+	const size_t chunkSize = (size + chunkCount - 1) / chunkCount;
+	std::vector<std::array<uint32_t, RADIX_SORT_BUCKETS>> chunkOffsets(chunkCount);
+
+	for (int shift = 0; shift < 2 * MORTON_BITS_PER_AXIS; shift += RADIX_SORT_DIGIT_BITS)
+	{
+		tbb::parallel_for(static_cast<size_t>(0), chunkCount, [&](const size_t chunk)
+		{
+			auto& counts = chunkOffsets[chunk];
+			counts.fill(0);
+
+			const size_t chunkEnd = std::min(size, (chunk + 1) * chunkSize);
+			for (size_t i = chunk * chunkSize; i < chunkEnd; ++i)
+				++counts[keys[i] >> shift & RADIX_SORT_DIGIT_MASK];
+		});
+
+		// Turn counts into each chunk's starting offset for each digit.
+		uint32_t offset = 0;
+		bool allSameDigit = false;
+
+		for (int digit = 0; digit < RADIX_SORT_BUCKETS; ++digit)
+		{
+			const uint32_t digitStart = offset;
+
+			for (auto& counts : chunkOffsets)
+			{
+				const uint32_t count = counts[digit];
+				counts[digit] = offset;
+				offset += count;
+			}
+
+			if (offset - digitStart == size)
+				allSameDigit = true;
+		}
+
+		// Common for the high digits of clustered bodies.
+		if (allSameDigit)
+			continue;
+
+		tbb::parallel_for(static_cast<size_t>(0), chunkCount, [&](const size_t chunk)
+		{
+			auto& offsets = chunkOffsets[chunk];
+
+			const size_t chunkEnd = std::min(size, (chunk + 1) * chunkSize);
+			for (size_t i = chunk * chunkSize; i < chunkEnd; ++i)
+			{
+				const uint32_t destination = offsets[keys[i] >> shift & RADIX_SORT_DIGIT_MASK]++;
+				keysScratch[destination] = keys[i];
+				valuesScratch[destination] = values[i];
+			}
+		});
+
+		keys.swap(keysScratch);
+		values.swap(valuesScratch);
+	}
+}
+
+template <typename Real>
+void QuadTree<Real>::sortByMortonKey()
+{
+	const Vec2_t<Real> origin = m_boundsCenter - m_boundsSize / 2.0f;
+	const Real scale = m_boundsSize > 0 ? static_cast<Real>(1 << MORTON_BITS_PER_AXIS) / m_boundsSize : 0.0f;
+
+	m_mortonKeys.resize(m_indices.size());
+	std::transform(std::execution::par_unseq, m_indices.begin(), m_indices.end(), m_mortonKeys.begin(),
+		[this, origin, scale](const BodyIndex_t index) { return mortonKey((*m_positions)[index], origin, scale); });
 
-	const auto ySplit = std::partition(begin, end, top);
-	const auto xSplitUpper = std::partition(begin, ySplit, left);
-	const auto xSplitLower = std::partition(ySplit, end, left);
+	radixSortByKey(m_mortonKeys, m_indices, m_mortonKeysScratch, m_indicesScratch);
+}
+
+template <typename Real>
+NodeIndex_t QuadTree<Real>::buildRoot()
+{
+	m_nodeCounter.store(0, std::memory_order_relaxed);
 
-	auto& [child1, child2, child3, child4] = m_nodes[result];
-	const float halfSize = size / 2.0f;
-	const float quarterSize = halfSize / 2.0f;
+	if (g_treeBuilder == TreeBuilder::Morton)
+		return buildTreeMorton(m_indices.begin(), m_indices.end(), m_boundsSize, m_boundsCenter, 0);
 
-	child1 = buildTree(begin, xSplitUpper, halfSize,
-		{center.x - quarterSize, center.y - quarterSize});
-	child2 = buildTree(xSplitUpper, ySplit, halfSize,
-		{center.x + quarterSize, center.y - quarterSize});
-	child3 = buildTree(ySplit, xSplitLower, halfSize,
-		{center.x - quarterSize, center.y + quarterSize});
-	child4 = buildTree(xSplitLower, end, halfSize,
-		{center.x + quarterSize, center.y + quarterSize});
+	return buildTree(m_indices.begin(), m_indices.end(), m_boundsSize, m_boundsCenter, 0);
+}
+
+template <typename Real>
+NodeIndex_t QuadTree<Real>::createNode(const IndexIt_t begin, const IndexIt_t end, const Real size,
+	const Vec2_t<Real> center, const int depth)
+{
+	// Claimed atomically as sibling subtrees may be built concurrently.
+	const NodeIndex_t result = m_nodeCounter.fetch_add(1, std::memory_order_relaxed);
+
+	// Out of arena. Keep counting so buildTree knows it has to grow, but don't build anything more below here.
+	if (result >= m_buildNodes.size())
+		return NULL_INDEX;
+
+	BuildNode& node = m_buildNodes[result];
+	node.children = {NULL_INDEX, NULL_INDEX, NULL_INDEX, NULL_INDEX};
+	node.bodies = {static_cast<BodyIndex_t>(begin - m_indices.begin()), static_cast<BodyIndex_t>(end - begin)};
+	node.cellCenter = center;
+	node.cellSize = size;
+	node.subtreeSize = 1;
+
+	// Leaf node. Bodies still sharing a cell at the maximum depth are all but coincident, so share a leaf rather than
+	// being split until the cell size underflows.
+	node.isLeaf = end - begin <= g_leafSize || depth >= MAX_TREE_DEPTH;
+	if (node.isLeaf)
+		gatherLeaf(node.bodies, node.com);
 
 	return result;
 }
 
-static glm::vec2 gravAccel(const glm::vec2 position, const glm::vec2 sourcePosition, const float sourceMass)
+template <typename Real>
+typename QuadTree<Real>::Bounds QuadTree<Real>::gatherLeaf(const BodyRange bodies, CoM<Real>& com)
 {
-	const glm::vec2 rel = sourcePosition - position;
-	const float sqrDist = glm::length2(rel);
+	Vec2_t<Real> momentSum = {};
+	Real massSum = 0;
+	Bounds bounds;
+
+	for (BodyIndex_t i = bodies.first; i < bodies.first + bodies.count; ++i)
+	{
+		const Vec2_t<Real> position = (*m_positions)[m_indices[i]];
+		const Real mass = (*m_masses)[m_indices[i]];
+
+		m_bodyXs[i] = position.x;
+		m_bodyYs[i] = position.y;
+		m_bodyMasses[i] = mass;
 
-	if (sqrDist <= SQR_DIST_EPSILON)
-		return {};
+		momentSum += position * mass;
+		massSum += mass;
+		bounds = bounds.merge({position, position});
+	}
 
-	const glm::vec2 dir = rel / sqrtf(sqrDist);
+	com.position = momentSum / massSum;
+	com.mass = massSum;
+
+	// Second moments about the CoM, so need a second pass now it's known.
+	com.momentXX = com.momentXY = com.momentYY = 0;
+
+	for (BodyIndex_t i = bodies.first; i < bodies.first + bodies.count; ++i)
+	{
+		const Vec2_t<Real> offset = bodyPosition(i) - com.position;
+		const Real mass = m_bodyMasses[i];
+
+		com.momentXX += mass * offset.x * offset.x;
+		com.momentXY += mass * offset.x * offset.y;
+		com.momentYY += mass * offset.y * offset.y;
+	}
 
-	return dir * g_gravConst * sourceMass / (g_gravSmoothness + sqrDist);
+	return bounds;
 }
 
-static glm::vec2 gravAccel(const glm::vec2 rel, const float sqrDist, const float sourceMass)
+// Adds a child's second moments to its parent's, shifted to the parent's CoM by the parallel axis theorem.
+template <typename Real>
+static void addChildMoments(CoM<Real>& com, const CoM<Real>& childCoM)
 {
-	const glm::vec2 dir = rel / sqrtf(sqrDist);
+	const Vec2_t<Real> offset = childCoM.position - com.position;
 
-	return dir * g_gravConst * sourceMass / (g_gravSmoothness + sqrDist);
+	com.momentXX += childCoM.momentXX + childCoM.mass * offset.x * offset.x;
+	com.momentXY += childCoM.momentXY + childCoM.mass * offset.x * offset.y;
+	com.momentYY += childCoM.momentYY + childCoM.mass * offset.y * offset.y;
 }
 
-glm::vec2 QuadTree::accelAt(const glm::vec2 position, const NodeIndex_t nodeIndex, const int depth) const
+template <typename Real>
+template <typename BuildFunc>
+void QuadTree<Real>::buildChildren(const NodeIndex_t nodeIndex, const std::array<IndexIt_t, 5>& splits,
+	const Real size, const Vec2_t<Real> center, BuildFunc buildChild)
 {
-	const CoM& com = m_nodeCoMs[nodeIndex];
+	BuildNode& node = m_buildNodes[nodeIndex];
+	auto& [child1, child2, child3, child4] = node.children;
+	const Real halfSize = size / 2.0f;
+	const Real quarterSize = halfSize / 2.0f;
+
+	auto buildChild1 = [&] { child1 = buildChild(splits[0], splits[1], halfSize,
+		Vec2_t<Real>{center.x - quarterSize, center.y - quarterSize}); };
+	auto buildChild2 = [&] { child2 = buildChild(splits[1], splits[2], halfSize,
+		Vec2_t<Real>{center.x + quarterSize, center.y - quarterSize}); };
+	auto buildChild3 = [&] { child3 = buildChild(splits[2], splits[3], halfSize,
+		Vec2_t<Real>{center.x - quarterSize, center.y + quarterSize}); };
+	auto buildChild4 = [&] { child4 = buildChild(splits[3], splits[4], halfSize,
+		Vec2_t<Real>{center.x + quarterSize, center.y + quarterSize}); };
+
+	if (splits[4] - splits[0] >= PARALLEL_BUILD_MIN_BODIES)
+	{
+		tbb::task_group group;
+		group.run(buildChild1);
+		group.run(buildChild2);
+		group.run(buildChild3);
+		buildChild4();
+		group.wait();
+	}
+	else
+	{
+		buildChild1();
+		buildChild2();
+		buildChild3();
+		buildChild4();
+	}
+
+	// Calculate CoM of node from its children's, so each body is only read once per build at its leaf.
+	Vec2_t<Real> momentSum = {};
+	Real massSum = 0;
 
-	// If leaf node, no further recursion can be done.
-	if (m_nodeIsLeaf[nodeIndex])
+	for (const NodeIndex_t child : node.children)
 	{
-		// Discard if leaf node has same position as current body.
-		if ((*m_positions)[m_nodeBodyIndices[nodeIndex]] == position)
-			return {};
+		if (child == NULL_INDEX)
+			continue;
 
-		return gravAccel(position, com.position, com.mass);
+		const BuildNode& childNode = m_buildNodes[child];
+		momentSum += childNode.com.position * childNode.com.mass;
+		massSum += childNode.com.mass;
+		node.subtreeSize += childNode.subtreeSize;
 	}
 
-	const glm::vec2 rel = com.position - position;
-	const float sqrDist = glm::length2(rel);
+	node.com.position = momentSum / massSum;
+	node.com.mass = massSum;
 
-	// Prevent NaNs/infs.
-	if (sqrDist <= SQR_DIST_EPSILON)
-		return {};
+	node.com.momentXX = node.com.momentXY = node.com.momentYY = 0;
+	for (const NodeIndex_t child : node.children)
+		if (child != NULL_INDEX)
+			addChildMoments(node.com, m_buildNodes[child].com);
+}
 
-	const float boundsSize = m_precomputedBoundsSizes[depth];
-	const float sqrBoundsSize = boundsSize * boundsSize;
-	const float sqrHeuristic = sqrBoundsSize / sqrDist;
+template <typename Real>
+void QuadTree<Real>::layoutDepthFirst(const NodeIndex_t buildIndex, const NodeIndex_t nodeIndex)
+{
+	const BuildNode& node = m_buildNodes[buildIndex];
 
-	// Decide whether to approximate gravitational field using the Barnes-Hut heuristic.
-	if (sqrHeuristic < g_theta * g_theta)
-		return gravAccel(rel, sqrDist, com.mass);
+	m_nodes[nodeIndex] = {node.com, node.cellSize * node.cellSize, nodeIndex + node.subtreeSize};
+	m_nodeBodyRanges[nodeIndex] = node.bodies;
+	m_nodeCells[nodeIndex] = {node.cellCenter, node.cellSize};
 
-	// Otherwise, recurse.
-	const Node& node = m_nodes[nodeIndex];
-	glm::vec2 accelSum = {};
+	// Each child goes after the whole subtree of the sibling before it.
+	NodeIndex_t childIndex = nodeIndex + 1;
 
-	if (node.child1 != NULL_INDEX)
-		accelSum += accelAt(position, node.child1, depth + 1);
-	if (node.child2 != NULL_INDEX)
-		accelSum += accelAt(position, node.child2, depth + 1);
-	if (node.child3 != NULL_INDEX)
-		accelSum += accelAt(position, node.child3, depth + 1);
-	if (node.child4 != NULL_INDEX)
-		accelSum += accelAt(position, node.child4, depth + 1);
+	if (node.bodies.count >= PARALLEL_BUILD_MIN_BODIES)
+	{
+		tbb::task_group group;
 
-	return accelSum;
+		for (const NodeIndex_t child : node.children)
+		{
+			if (child == NULL_INDEX)
+				continue;
+
+			group.run([this, child, childIndex] { layoutDepthFirst(child, childIndex); });
+			childIndex += m_buildNodes[child].subtreeSize;
+		}
+
+		group.wait();
+	}
+	else
+	{
+		for (const NodeIndex_t child : node.children)
+		{
+			if (child == NULL_INDEX)
+				continue;
+
+			layoutDepthFirst(child, childIndex);
+			childIndex += m_buildNodes[child].subtreeSize;
+		}
+	}
 }
 
-void QuadTree::visualize(const NodeIndex_t nodeIndex, const Rectangle rect, const float cameraZoom) const
+template <typename Real>
+typename QuadTree<Real>::RefitResult QuadTree<Real>::refitTree(const NodeIndex_t nodeIndex, const int depth)
 {
-	DrawRectangleRec(rect, QUADTREE_VIS_FILL_COLOR);
+	CoM<Real>& com = m_nodes[nodeIndex].com;
+	Bounds bounds;
+	double weightedGrowth = 0;
+	double weight = 0;
+
+	if (isLeaf(nodeIndex))
+		bounds = gatherLeaf(m_nodeBodyRanges[nodeIndex], com);
+	else
+	{
+		std::array<NodeIndex_t, 4> children;
+		std::array<RefitResult, 4> childResults;
+		int childCount = 0;
+
+		for (NodeIndex_t child = nodeIndex + 1; child < m_nodes[nodeIndex].skip; child = m_nodes[child].skip)
+			children[childCount++] = child;
+
+		if (depth < PARALLEL_REFIT_MAX_DEPTH)
+		{
+			tbb::task_group group;
+
+			for (int child = 0; child < childCount; ++child)
+				group.run([&, child] { childResults[child] = refitTree(children[child], depth + 1); });
+
+			group.wait();
+		}
+		else
+		{
+			for (int child = 0; child < childCount; ++child)
+				childResults[child] = refitTree(children[child], depth + 1);
+		}
+
+		Vec2_t<Real> momentSum = {};
+		Real massSum = 0;
+
+		for (int child = 0; child < childCount; ++child)
+		{
+			const CoM<Real>& childCoM = m_nodes[children[child]].com;
+			momentSum += childCoM.position * childCoM.mass;
+			massSum += childCoM.mass;
+
+			bounds = bounds.merge(childResults[child].bounds);
+			weightedGrowth += childResults[child].weightedGrowth;
+			weight += childResults[child].weight;
+		}
+
+		com.position = momentSum / massSum;
+
+		com.momentXX = com.momentXY = com.momentYY = 0;
+		for (int child = 0; child < childCount; ++child)
+			addChildMoments(com, m_nodes[children[child]].com);
+	}
+
+	// Grow the node to the widest extent of its bodies once they spread wider than its original cell. The opening
+	// criterion only needs the size to bound how far the bodies are from the CoM, which lies inside that extent, so
+	// bodies that drift together don't grow the node.
+	const Real cellSize = m_nodeCells[nodeIndex].size;
+	const Vec2_t<Real> extent = bounds.max - bounds.min;
+	const Real size = std::max(cellSize, std::max(extent.x, extent.y));
 
-	if (m_nodeIsLeaf[nodeIndex])
+	m_nodes[nodeIndex].sqrSize = size * size;
+	if (cellSize > 0)
 	{
-		DrawRectangleLinesEx(rect, QUADTREE_VIS_LINE_THICKNESS / cameraZoom, QUADTREE_VIS_LEAF_OUTLINE_COLOR);
-		return;
+		const BodyIndex_t bodyCount = m_nodeBodyRanges[nodeIndex].count;
+		weightedGrowth += static_cast<double>(bodyCount) * (size / cellSize);
+		weight += bodyCount;
 	}
 
-	const auto& [child1, child2, child3, child4] = m_nodes[nodeIndex];
-
-	DrawRectangleLinesEx(rect, QUADTREE_VIS_LINE_THICKNESS / cameraZoom, QUADTREE_VIS_OUTLINE_COLOR);
-
-	if (child1 != NULL_INDEX)
-		visualize(child1,
-			{rect.x, rect.y, rect.width / 2.0f, rect.height / 2.0f}, cameraZoom);
-	if (child2 != NULL_INDEX)
-		visualize(child2,
-			{rect.x + rect.width / 2.0f, rect.y, rect.width / 2.0f, rect.height / 2.0f}, cameraZoom);
-	if (child3 != NULL_INDEX)
-		visualize(child3,
-			{rect.x, rect.y + rect.height / 2.0f, rect.width / 2.0f, rect.height / 2.0f}, cameraZoom);
-	if (child4 != NULL_INDEX)
-		visualize(child4,
-			{rect.x + rect.width / 2.0f, rect.y + rect.height / 2.0f,
-				rect.width / 2.0f, rect.height / 2.0f}, cameraZoom);
+	return {bounds, weightedGrowth, weight};
 }
+
+template <typename Real>
+NodeIndex_t QuadTree<Real>::buildTree(const IndexIt_t begin, const IndexIt_t end, const Real size,
+	const Vec2_t<Real> center, const int depth)
+{
+	// Exit if range empty.
+	if (begin == end)
+		return NULL_INDEX;
+
+	const NodeIndex_t result = createNode(begin, end, size, center, depth);
+	if (result == NULL_INDEX || m_buildNodes[result].isLeaf)
+		return result;
+
+	// Partition bodies into quadrants and recurse.
+	auto top  = [this, center](const BodyIndex_t index) { return (*m_positions)[index].y < center.y; };
+	auto left = [this, center](const BodyIndex_t index) { return (*m_positions)[index].x < center.x; };
+
+	IndexIt_t ySplit, xSplitUpper, xSplitLower;
+
+	if (end - begin >= PARALLEL_BUILD_MIN_BODIES)
+	{
+		ySplit = std::partition(std::execution::par_unseq, begin, end, top);
+		xSplitUpper = std::partition(std::execution::par_unseq, begin, ySplit, left);
+		xSplitLower = std::partition(std::execution::par_unseq, ySplit, end, left);
+	}
+	else
+	{
+		ySplit = std::partition(begin, end, top);
+		xSplitUpper = std::partition(begin, ySplit, left);
+		xSplitLower = std::partition(ySplit, end, left);
+	}
+
+	buildChildren(result, {begin, xSplitUpper, ySplit, xSplitLower, end}, size, center,
+		[this, depth](const IndexIt_t childBegin, const IndexIt_t childEnd, const Real childSize,
+			const Vec2_t<Real> childCenter)
+		{
+			return buildTree(childBegin, childEnd, childSize, childCenter, depth + 1);
+		});
+
+	return result;
+}
+
+template <typename Real>
+NodeIndex_t QuadTree<Real>::buildTreeMorton(const IndexIt_t begin, const IndexIt_t end, const Real size,
+	const Vec2_t<Real> center, const int level)
+{
+	// Exit if range empty.
+	if (begin == end)
+		return NULL_INDEX;
+
+	// Bodies this close together share a key; let the partition builder separate them.
+	if (level == MORTON_BITS_PER_AXIS && end - begin > g_leafSize)
+		return buildTree(begin, end, size, center, level);
+
+	const NodeIndex_t result = createNode(begin, end, size, center, level);
+	if (result == NULL_INDEX || m_buildNodes[result].isLeaf)
+		return result;
+
+	// Keys are sorted and share every digit above this level, so each quadrant is a contiguous run of keys.
+	const int shift = 2 * (MORTON_BITS_PER_AXIS - 1 - level);
+	const auto keyBegin = m_mortonKeys.begin() + (begin - m_indices.begin());
+	const auto keyEnd = keyBegin + (end - begin);
+
+	auto quadrantSplit = [&](const uint32_t quadrant)
+	{
+		const auto keySplit = std::partition_point(keyBegin, keyEnd,
+			[shift, quadrant](const uint32_t key) { return (key >> shift & 3u) < quadrant; });
+		return begin + (keySplit - keyBegin);
+	};
+
+	buildChildren(result, {begin, quadrantSplit(1), quadrantSplit(2), quadrantSplit(3), end}, size, center,
+		[this, level](const IndexIt_t childBegin, const IndexIt_t childEnd, const Real childSize,
+			const Vec2_t<Real> childCenter)
+		{
+			return buildTreeMorton(childBegin, childEnd, childSize, childCenter, level + 1);
+		});
+
+	return result;
+}
+
+template class QuadTree<float>;
+template class QuadTree<double>;
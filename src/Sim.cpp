@@ -7,11 +7,18 @@
 #include <algorithm>
 #include <execution>
 #include <format>
+#include <numeric>
+#include <utility>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/norm.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
 
 #include "BodyGenerator.hpp"
+#include "Checkpoint.hpp"
 #include "colormap.hpp"
+#include "integrators.hpp"
+#include "Timings.hpp"
 
 static constexpr float CAMERA_ZOOM_BUTTON_SPEED = 0.05f;
 static constexpr float CAMERA_ZOOM_SCROLL_SPEED = 0.15f;
@@ -21,15 +28,105 @@ static constexpr float CAMERA_MIN_ZOOM = 0.1f;
 static constexpr float MIN_TIMESCALE = 1.0f / 64.0f;
 static constexpr float MAX_TIMESCALE = 8;
 
-Sim::Sim(const char* generationPath) : m_quadTree(m_positions, m_masses), m_circleTex(), m_camera()
+// The frame time graph is scaled so the target frame time is halfway up.
+static constexpr int TIMING_GRAPH_HEIGHT = 80;
+static constexpr int TIMING_GRAPH_BAR_WIDTH = 2;
+static constexpr Color TIMING_GRAPH_BACKGROUND_COLOR = {0, 0, 0, 150};
+// Frames this much longer than the target frame time are drawn as missed.
+static constexpr float TIMING_GRAPH_MISSED_FRAME_RATIO = 1.05f;
+
+template <typename Real>
+static std::vector<Vec2_t<Real>> convertVectors(const std::vector<glm::vec2>& vectors)
 {
-	BodyGenerator::generateBodies(generationPath, m_positions, m_velocities, m_masses, m_diameters);
+	std::vector<Vec2_t<Real>> result(vectors.size());
+	std::ranges::transform(vectors, result.begin(), [](const glm::vec2 vector) { return Vec2_t<Real>(vector); });
+	return result;
+}
 
-	assert(m_positions.size() == m_velocities.size() && m_velocities.size() == m_masses.size());
+template <typename StorageReal, typename ForceReal>
+Sim<StorageReal, ForceReal>::Sim() : m_quadTree(treePositions(), m_masses), m_fmmSolver(m_quadTree),
+	m_directSolver(treePositions(), m_masses), m_circleTex(), m_camera() { }
 
-	m_quadTree.buildTree();
+template <typename StorageReal, typename ForceReal>
+Sim<StorageReal, ForceReal>::Sim(const char* generationPath, const bool headless) : Sim()
+{
+	// Bodies are always generated in float.
+	std::vector<glm::vec2> positions;
+	std::vector<glm::vec2> velocities;
+	std::vector<float> masses;
+	BodyGenerator::generateBodies(generationPath, positions, velocities, masses, m_diameters);
+
+	assert(positions.size() == velocities.size() && velocities.size() == masses.size());
+
+	m_positions = convertVectors<StorageReal>(positions);
+	m_velocities = convertVectors<StorageReal>(velocities);
+	m_masses.assign(masses.begin(), masses.end());
+
+	m_bodyIds.resize(m_positions.size());
+	std::iota(m_bodyIds.begin(), m_bodyIds.end(), 0);
+	m_timestepLevels.resize(m_positions.size());
+
+	initializeTree();
 	initializeVelocities();
 
+	if (!headless)
+		initializeWindow();
+}
+
+template <typename StorageReal, typename ForceReal>
+Sim<StorageReal, ForceReal>::Sim(const Checkpoint& checkpoint, const bool headless) : Sim()
+{
+	checkpoint.readColumn(CheckpointColumn::Positions, m_positions);
+	checkpoint.readColumn(CheckpointColumn::Velocities, m_velocities);
+	checkpoint.readColumn(CheckpointColumn::Masses, m_masses);
+	checkpoint.readColumn(CheckpointColumn::Diameters, m_diameters);
+	checkpoint.readColumn(CheckpointColumn::BodyIds, m_bodyIds);
+	checkpoint.readColumn(CheckpointColumn::TimestepLevels, m_timestepLevels);
+	const CheckpointState& state = checkpoint.getState();
+	m_step = state.step;
+	m_time = state.time;
+
+	initializeTree(&checkpoint);
+
+	// Velocities were saved already kicked ahead, so are only initialized again if they were kicked for a different
+	// scheme or step length.
+	if (state.integrator != static_cast<uint32_t>(g_integrator) ||
+		state.blockTimestepLevels != static_cast<uint32_t>(g_blockTimestepLevels) ||
+		state.deltaTime != static_cast<double>(g_deltaTime))
+		resynchronizeVelocities(state);
+
+	if (!headless)
+		initializeWindow();
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::initializeTree(const Checkpoint* checkpoint)
+{
+	m_activeBodies.resize(m_positions.size());
+
+	if constexpr (MIXED_PRECISION)
+		m_treePositions.resize(m_positions.size());
+
+	// Positions are only saved in the same size in the same precision, bar DOUBLE and MIXED, whose trees' nodes differ.
+	if (checkpoint && checkpoint->getElementSize(CheckpointColumn::Positions) == sizeof(Vec2_t<StorageReal>))
+	{
+		const auto [originX, originY] = checkpoint->getState().origin;
+		m_origin = Vec2_t<StorageReal>(originX, originY);
+		convertTreePositions();
+
+		if (m_quadTree.restore(*checkpoint))
+			return;
+	}
+
+	syncTreePositions();
+	m_quadTree.buildTree();
+	if (g_reorderBodies)
+		reorderBodies();
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::initializeWindow()
+{
 	if (g_resizable)
 		SetConfigFlags(FLAG_WINDOW_RESIZABLE);
 	SetTraceLogLevel(LOG_ERROR); // Suppress Raylib logs.
@@ -37,6 +134,7 @@ Sim::Sim(const char* generationPath) : m_quadTree(m_positions, m_masses), m_circ
 	SetTargetFPS(g_targetFPS);
 
 	m_circleTex = LoadTexture("assets/circle.png");
+	m_bodyRenderer.load(m_circleTex);
 
 	m_camera.target = {0, 0};
 	m_camera.offset = {g_screenDims.x / 2.0f, g_screenDims.y / 2.0f};
@@ -44,25 +142,265 @@ Sim::Sim(const char* generationPath) : m_quadTree(m_positions, m_masses), m_circ
 	m_camera.zoom = 1.0f;
 }
 
-void Sim::run()
+template <typename StorageReal, typename ForceReal>
+Sim<StorageReal, ForceReal>::~Sim()
+{
+	if (!m_stepThread.joinable())
+		return;
+
+	{
+		std::lock_guard lock(m_stepMutex);
+		m_stopStepping = true;
+	}
+	m_stepRequested.notify_one();
+	m_stepThread.join();
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::run()
 {
+	fillSnapshot(m_snapshots[m_frontSnapshot]);
+	m_stepThread = std::thread(&Sim::stepLoop, this);
+
 	while (!WindowShouldClose())
 	{
 		updateScreenDims();
 		takeInput();
-		if (!m_paused)
-			update();
+		// Otherwise the frame just draws the last completed step again.
+		if (!m_stepRunning.load(std::memory_order_acquire))
+			betweenSteps();
 		draw();
+		g_timings.endFrame();
+	}
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::runHeadless(const uint64_t steps)
+{
+	for (uint64_t i = 0; i < steps; ++i)
+	{
+		step();
+		saveCheckpointIfDue();
+		g_timings.endFrame();
+	}
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::setCheckpointing(const char* path, const uint64_t interval)
+{
+	m_checkpointPath = path;
+	m_checkpointInterval = interval;
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::saveCheckpoint() const
+{
+	const size_t bodyCount = m_positions.size();
+	std::array<CheckpointColumnData, CHECKPOINT_COLUMN_COUNT> columns = {{
+		{m_positions.data(), bodyCount, sizeof(Vec2_t<StorageReal>)},
+		{m_velocities.data(), bodyCount, sizeof(Vec2_t<StorageReal>)},
+		{m_masses.data(), bodyCount, sizeof(ForceReal)},
+		{m_diameters.data(), bodyCount, sizeof(float)},
+		{m_bodyIds.data(), bodyCount, sizeof(BodyIndex_t)},
+		{m_timestepLevels.data(), bodyCount, sizeof(uint8_t)}
+	}};
+	m_quadTree.getCheckpointColumns(columns);
+
+	const CheckpointState state = {m_step, m_time, m_quadTree.getStepsSinceRebuild(), static_cast<uint32_t>(g_integrator),
+		static_cast<uint32_t>(g_blockTimestepLevels), 0, g_deltaTime,
+		{static_cast<double>(m_origin.x), static_cast<double>(m_origin.y)}};
+	writeCheckpoint(m_checkpointPath.c_str(), bodyCount, state, simulationParametersToString(), columns);
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::setTrajectoryOutput(const char* path)
+{
+	m_trajectoryWriter = std::make_unique<TrajectoryWriter<StorageReal>>(path, m_positions.size());
+	writeTrajectoryFrame();
+}
+
+template <typename StorageReal, typename ForceReal>
+size_t Sim<StorageReal, ForceReal>::getBodyCount() const
+{
+	return m_positions.size();
+}
+
+template <typename StorageReal, typename ForceReal>
+const std::vector<Vec2_t<ForceReal>>& Sim<StorageReal, ForceReal>::treePositions() const
+{
+	if constexpr (MIXED_PRECISION)
+		return m_treePositions;
+	else
+		return m_positions;
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::syncTreePositions()
+{
+	if constexpr (MIXED_PRECISION)
+	{
+		// Refits keep the cells of the last rebuild, so the origin can only move with a rebuild.
+		if (m_quadTree.rebuildDue())
+			m_origin = bodiesCoMPosition();
+	}
+
+	convertTreePositions();
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::convertTreePositions()
+{
+	if constexpr (MIXED_PRECISION)
+	{
+		std::transform(std::execution::par_unseq, m_positions.begin(), m_positions.end(), m_treePositions.begin(),
+			[this](const Vec2_t<StorageReal> position) { return Vec2_t<ForceReal>(position - m_origin); });
+	}
+}
+
+template <typename StorageReal, typename ForceReal>
+Vec2_t<StorageReal> Sim<StorageReal, ForceReal>::bodiesCoMPosition() const
+{
+	const Vec2_t<StorageReal> momentSum = std::transform_reduce(std::execution::par_unseq,
+		m_positions.begin(), m_positions.end(), m_masses.begin(), Vec2_t<StorageReal>{}, std::plus<>(),
+		[](const Vec2_t<StorageReal> position, const ForceReal mass) { return position * StorageReal{mass}; });
+	const StorageReal massSum = std::reduce(std::execution::par_unseq, m_masses.begin(), m_masses.end(),
+		StorageReal{0});
+
+	return massSum > 0 ? momentSum / massSum : Vec2_t<StorageReal>{};
+}
+
+template <typename StorageReal, typename ForceReal>
+Vec2_t<StorageReal> Sim<StorageReal, ForceReal>::systemCoMPosition() const
+{
+	if constexpr (MIXED_PRECISION)
+		return m_origin + Vec2_t<StorageReal>(m_quadTree.getSystemCoMPosition());
+	else
+		return m_quadTree.getSystemCoMPosition();
+}
+
+// Step of bodies on a block timestep level, in units of the shortest step.
+static uint32_t levelStepUnits(const int level)
+{
+	return 1u << (g_blockTimestepLevels - 1 - level);
+}
+
+// Shortest level whose step is short enough for a body with the given acceleration.
+template <typename Real>
+static int timestepLevel(const Vec2_t<Real> acceleration)
+{
+	const double accel = glm::length(glm::dvec2(acceleration));
+	if (g_blockTimestepLevels == 1 || accel == 0)
+		return 0;
+
+	// Longest step over which the acceleration moves the body by at most BLOCKTIMESTEPTOLERANCE.
+	const double step = std::sqrt(2.0 * g_blockTimestepTolerance / accel);
+	const double level = std::ceil(std::log2(g_deltaTime / step));
+
+	return static_cast<int>(std::clamp(level, 0.0, static_cast<double>(g_blockTimestepLevels - 1)));
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::initializeVelocities()
+{
+	computeAccelerations();
+	halfKickVelocities();
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::resynchronizeVelocities(const CheckpointState& state)
+{
+	computeAccelerations();
+
+	const double savedFirstKick = integratorScheme(static_cast<Integrator>(state.integrator)).kicks[0];
+	const auto savedMaxLevel = static_cast<uint8_t>(state.blockTimestepLevels - 1);
+
+	for (BodyIndex_t i = 0; i < m_positions.size(); ++i)
+	{
+		const int level = std::min(m_timestepLevels[i], savedMaxLevel);
+		const auto halfStep = static_cast<StorageReal>(state.deltaTime * savedFirstKick / 2) /
+			static_cast<StorageReal>(1 << level);
+
+		m_velocities[i] -= Vec2_t<StorageReal>(m_accelerations[i]) * halfStep;
 	}
+
+	halfKickVelocities();
 }
 
-void Sim::initializeVelocities()
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::halfKickVelocities()
 {
+	const double firstKick = integratorScheme(g_integrator).kicks[0];
+
 	for (BodyIndex_t i = 0; i < m_positions.size(); ++i)
-		m_velocities[i] += m_quadTree.accelAt(m_positions[i]) * g_deltaTime * 0.5f;
+	{
+		const int level = timestepLevel(m_accelerations[i]);
+		const auto halfStep = static_cast<StorageReal>(g_deltaTime * firstKick / 2) /
+			static_cast<StorageReal>(1 << level);
+
+		m_timestepLevels[i] = level;
+		m_velocities[i] += Vec2_t<StorageReal>(m_accelerations[i]) * halfStep;
+	}
+}
+
+template <typename StorageReal, typename ForceReal>
+bool Sim<StorageReal, ForceReal>::usesDirectSum() const
+{
+	return g_solver == Solver::Direct || (g_solver == Solver::FMM ? g_fmmTheta : g_theta) == 0 ||
+		m_positions.size() <= static_cast<size_t>(g_directSumMaxBodies);
 }
 
-void Sim::updateScreenDims()
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::computeAccelerations(const std::vector<uint8_t>* active)
+{
+	ScopedTimer timer(TimingPhase::Forces);
+
+	if (usesDirectSum())
+		m_directSolver.computeAccelerations(m_accelerations, active);
+	else if (g_solver == Solver::FMM)
+		m_fmmSolver.computeAccelerations(m_accelerations, active);
+	else
+		m_quadTree.computeAccelerations(m_accelerations, active);
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::updateQuadTree()
+{
+	syncTreePositions();
+
+	if (m_quadTree.updateTree() && g_reorderBodies)
+		reorderBodies();
+}
+
+// Reorders values so that the value at i is the one that was at order[i].
+template <typename T>
+static void permute(std::vector<T>& values, const std::vector<BodyIndex_t>& order)
+{
+	std::vector<T> permuted(values.size());
+	std::transform(std::execution::par_unseq, order.begin(), order.end(), permuted.begin(),
+		[&](const BodyIndex_t index) { return values[index]; });
+	values.swap(permuted);
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::reorderBodies()
+{
+	ScopedTimer timer(TimingPhase::Reorder);
+	const auto& indices = m_quadTree.getIndices();
+
+	permute(m_positions, indices);
+	permute(m_velocities, indices);
+	permute(m_masses, indices);
+	permute(m_diameters, indices);
+	permute(m_bodyIds, indices);
+	permute(m_timestepLevels, indices);
+	if constexpr (MIXED_PRECISION)
+		permute(m_treePositions, indices);
+
+	m_quadTree.onBodiesReordered();
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::updateScreenDims()
 {
 	if (IsWindowResized())
 	{
@@ -72,7 +410,8 @@ void Sim::updateScreenDims()
 	}
 }
 
-void Sim::takeInput()
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::takeInput()
 {
 	// Camera.
 	if (IsKeyDown(KEY_MINUS))
@@ -104,11 +443,7 @@ void Sim::takeInput()
 	}
 
 	if (IsKeyPressed(KEY_F))
-	{
-		const glm::vec2 CoMPosition = m_quadTree.getSystemCoMPosition();
-		m_camera.target.x = CoMPosition.x;
-		m_camera.target.y = CoMPosition.y;
-	}
+		m_pendingInput.focusCoM = true;
 
 	if (m_camera.zoom > CAMERA_MAX_ZOOM)
 		m_camera.zoom = CAMERA_MAX_ZOOM;
@@ -117,16 +452,9 @@ void Sim::takeInput()
 
 	// Time scale.
 	if (IsKeyPressed(KEY_COMMA))
-		g_timeScale /= 2.0f;
+		--m_pendingInput.timeScaleDoublings;
 	if (IsKeyPressed(KEY_PERIOD))
-		g_timeScale *= 2.0f;
-
-	if (g_timeScale > MAX_TIMESCALE)
-		g_timeScale = MAX_TIMESCALE;
-	if (g_timeScale < MIN_TIMESCALE)
-		g_timeScale = MIN_TIMESCALE;
-
-	g_deltaTime = g_timeScale / static_cast<float>(g_targetFPS);
+		++m_pendingInput.timeScaleDoublings;
 
 	// Colormap mode.
 	if (IsKeyPressed(KEY_G))
@@ -144,121 +472,392 @@ void Sim::takeInput()
 		m_paused = !m_paused;
 	TOGGLE(KEY_Q, m_visualizeQuadTree);
 	TOGGLE(KEY_D, m_showDetails);
-	TOGGLE(KEY_R, m_timeReverse);
+	TOGGLE(KEY_R, m_pendingInput.toggleTimeReverse);
 	TOGGLE(KEY_C, m_showControls);
 #undef TOGGLE
+
+	if (IsKeyPressed(KEY_K))
+		m_pendingInput.saveCheckpoint = true;
 }
 
-void Sim::update()
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::step()
 {
-	const auto& indices = m_quadTree.getIndices();
+	update();
+	++m_step;
+	m_time += m_timeReverse ? -g_deltaTime : g_deltaTime;
 
-	if (m_timeReverse)
+	if (m_trajectoryWriter && m_step % g_trajectoryInterval == 0)
+		writeTrajectoryFrame();
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::saveCheckpointIfDue() const
+{
+	if (m_checkpointInterval > 0 && m_step % m_checkpointInterval == 0)
+		saveCheckpoint();
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::writeTrajectoryFrame()
+{
+	ScopedTimer timer(TimingPhase::Trajectory);
+	m_trajectoryWriter->submit(m_step, m_time, m_positions, m_velocities, m_bodyIds);
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::stepLoop()
+{
+	while (true)
 	{
-		std::for_each(std::execution::par_unseq, indices.begin(), indices.end(),
-		   [&](const BodyIndex_t index)
-		   {
-			   m_positions[index] -= m_velocities[index] * g_deltaTime;
-		   });
-
-		m_quadTree.buildTree();
-
-		std::for_each(std::execution::par_unseq, indices.begin(), indices.end(),
-		   [&](const BodyIndex_t index)
-		   {
-			   m_velocities[index] -= m_quadTree.accelAt(m_positions[index]) * g_deltaTime;
-		   });
+		{
+			std::unique_lock lock(m_stepMutex);
+			m_stepRequested.wait(lock, [this] { return m_stepPending || m_stopStepping; });
+
+			if (m_stopStepping)
+				return;
+			m_stepPending = false;
+		}
+
+		try
+		{
+			step();
+			fillSnapshot(m_snapshots[1 - m_frontSnapshot]);
+			m_stepCompleted = true;
+		}
+		catch (...)
+		{
+			m_stepError = std::current_exception();
+		}
+
+		m_stepRunning.store(false, std::memory_order_release);
 	}
-	else
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::betweenSteps()
+{
+	if (m_stepError)
+		std::rethrow_exception(std::exchange(m_stepError, nullptr));
+
+	if (m_stepCompleted)
+	{
+		m_frontSnapshot = 1 - m_frontSnapshot;
+		m_stepCompleted = false;
+		saveCheckpointIfDue();
+	}
+
+	applyPendingInput();
+
+	if (m_paused)
 	{
-		std::for_each(std::execution::par_unseq, indices.begin(), indices.end(),
-		   [&](const BodyIndex_t index)
-		   {
-			   m_velocities[index] += m_quadTree.accelAt(m_positions[index]) * g_deltaTime;
-			   m_positions[index] += m_velocities[index] * g_deltaTime;
-		   });
-
-		m_quadTree.buildTree();
+		// Nothing else will refill the snapshot to show or hide the quadtree.
+		if (m_snapshotTreeCells != m_visualizeQuadTree)
+		{
+			m_snapshotTreeCells = m_visualizeQuadTree;
+			fillSnapshot(m_snapshots[m_frontSnapshot]);
+		}
+		return;
 	}
 
+	m_snapshotTreeCells = m_visualizeQuadTree;
+	m_stepRunning.store(true, std::memory_order_relaxed);
+	{
+		std::lock_guard lock(m_stepMutex);
+		m_stepPending = true;
+	}
+	m_stepRequested.notify_one();
 }
 
-void Sim::draw() const
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::applyPendingInput()
 {
-	BeginDrawing();
-	ClearBackground(BLACK);
+	g_timeScale = std::clamp(std::ldexp(g_timeScale, m_pendingInput.timeScaleDoublings), MIN_TIMESCALE,
+		MAX_TIMESCALE);
+	g_deltaTime = g_timeScale / static_cast<float>(g_targetFPS);
 
-	BeginMode2D(m_camera);
-	for (BodyIndex_t i = 0; i < m_positions.size(); ++i)
+	if (m_pendingInput.toggleTimeReverse)
+		m_timeReverse = !m_timeReverse;
+
+	if (m_pendingInput.focusCoM)
+	{
+		const glm::vec2 CoMPosition(systemCoMPosition());
+		m_camera.target.x = CoMPosition.x;
+		m_camera.target.y = CoMPosition.y;
+	}
+
+	if (m_pendingInput.saveCheckpoint)
+		saveCheckpoint();
+
+	m_pendingInput = {};
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::fillSnapshot(Snapshot& snapshot) const
+{
+	ScopedTimer timer(TimingPhase::Snapshot);
+
+	const auto toFloat = [](const Vec2_t<StorageReal> vector) { return glm::vec2(vector); };
+	snapshot.positions.resize(m_positions.size());
+	snapshot.velocities.resize(m_velocities.size());
+	std::transform(std::execution::par_unseq, m_positions.begin(), m_positions.end(), snapshot.positions.begin(),
+		toFloat);
+	std::transform(std::execution::par_unseq, m_velocities.begin(), m_velocities.end(), snapshot.velocities.begin(),
+		toFloat);
+	snapshot.diameters = m_diameters;
+
+	snapshot.treeCells.clear();
+	if (m_snapshotTreeCells)
 	{
-		const glm::vec2 position = m_positions[i];
-		const float diameter = m_diameters[i];
-		const float radius = diameter / 2.0f;
+		m_quadTree.collectCells(snapshot.treeCells);
 
-		Color bodyColor;
+		// The tree is built relative to m_origin.
+		if constexpr (MIXED_PRECISION)
+		{
+			for (QuadTreeCell& cell : snapshot.treeCells)
+				cell.center += glm::vec2(m_origin);
+		}
+	}
 
-		switch (g_colormapMode)
+	snapshot.step = m_step;
+	snapshot.solver = usesDirectSum() ? Solver::Direct : g_solver;
+}
+
+template <typename StorageReal, typename ForceReal>
+const typename Sim<StorageReal, ForceReal>::Snapshot& Sim<StorageReal, ForceReal>::frontSnapshot() const
+{
+	return m_snapshots[m_frontSnapshot];
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::update()
+{
+	if (g_blockTimestepLevels > 1)
+	{
+		updateBlockTimesteps();
+		return;
+	}
+
+	const IntegratorScheme scheme = integratorScheme(g_integrator);
+	const int stages = scheme.forceEvaluations();
+
+	if (m_timeReverse)
+	{
+		// Undoes each stage of a forward step in reverse order.
+		for (int stage = stages - 1; stage >= 0; --stage)
 		{
-		case ColormapMode::None:
-			bodyColor = Color{g_bodyColor.r, g_bodyColor.g, g_bodyColor.b, static_cast<unsigned char>(g_bodyAlpha)};
-			break;
+			const auto driftTime = static_cast<StorageReal>(g_deltaTime * scheme.drifts[stage]);
+			const auto kickTime = static_cast<StorageReal>(g_deltaTime * scheme.kicks[stage]);
 
-		case ColormapMode::Speed:
+			forEachBody([&](const BodyIndex_t index)
 			{
-				const float sqrVelocity = glm::length2(m_velocities[i]);
-				const int colormapIndex =
-					std::clamp(static_cast<int>(sqrVelocity / g_colormapMaxSqrSpeed * SPEED_COLORMAP_SIZE),
-						0, SPEED_COLORMAP_SIZE - 1);
-				const auto [r, g, b] = SPEED_COLORMAP_ARRAY[colormapIndex];
-				bodyColor = Color{r, g, b, static_cast<unsigned char>(g_bodyAlpha)};
-				break;
-			}
-
-		case ColormapMode::Velocity:
+				m_positions[index] -= m_velocities[index] * driftTime;
+			});
+
+			updateQuadTree();
+			computeAccelerations();
+
+			forEachBody([&](const BodyIndex_t index)
+			{
+				m_velocities[index] -= Vec2_t<StorageReal>(m_accelerations[index]) * kickTime;
+			});
+		}
+	}
+	else
+	{
+		for (int stage = 0; stage < stages; ++stage)
+		{
+			const auto kickTime = static_cast<StorageReal>(g_deltaTime * scheme.kicks[stage]);
+			const auto driftTime = static_cast<StorageReal>(g_deltaTime * scheme.drifts[stage]);
+
+			computeAccelerations();
+
+			forEachBody([&](const BodyIndex_t index)
 			{
-				const glm::vec2 velocity = m_velocities[i];
-				const float angle = atan2f(velocity.y, velocity.x) + PI;
-				const int colormapIndex =
-					std::clamp(static_cast<int>(angle / (2 * PI) * VELOCITY_COLORMAP_SIZE),
-						0, VELOCITY_COLORMAP_SIZE - 1);
-				const auto [r, g, b] = VELOCITY_COLORMAP_ARRAY[colormapIndex];
-				bodyColor = Color{r, g, b, static_cast<unsigned char>(g_bodyAlpha)};
-				break;
-			}
-
-		// Unreachable.
-		default:
-			throw std::runtime_error(std::format("Unknown colormap mode '{}'.", colormapModeToString(g_colormapMode)));
+				m_velocities[index] += Vec2_t<StorageReal>(m_accelerations[index]) * kickTime;
+				m_positions[index] += m_velocities[index] * driftTime;
+			});
+
+			updateQuadTree();
 		}
+	}
+}
+
+template <typename StorageReal, typename ForceReal>
+template <typename Func>
+void Sim<StorageReal, ForceReal>::forEachBody(Func func)
+{
+	ScopedTimer timer(TimingPhase::Integration);
+
+	const auto& indices = m_quadTree.getIndices();
+	std::for_each(std::execution::par_unseq, indices.begin(), indices.end(), func);
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::updateBlockTimesteps()
+{
+	// Time through the frame in units of the shortest step. Every level's steps line up at the start and end of the
+	// frame. Reversed time runs the same steps backwards, which unlike the single step isn't exactly reversible.
+	const uint32_t frameUnits = levelStepUnits(0);
+	const StorageReal unitTime = static_cast<StorageReal>(m_timeReverse ? -g_deltaTime : g_deltaTime) /
+		static_cast<StorageReal>(frameUnits);
+	uint32_t time = 0;
+
+	while (time < frameUnits)
+	{
+		forEachBody([&](const BodyIndex_t index)
+		{
+			m_activeBodies[index] = time % levelStepUnits(m_timestepLevels[index]) == 0;
+		});
+
+		computeAccelerations(&m_activeBodies);
+
+		forEachBody([&](const BodyIndex_t index)
+		{
+			if (!m_activeBodies[index])
+				return;
+
+			const int level = m_timestepLevels[index];
+			int newLevel = timestepLevel(m_accelerations[index]);
+
+			// A longer step can only start where it lines up with the frame.
+			while (newLevel < level && time % levelStepUnits(newLevel) != 0)
+				++newLevel;
+
+			// Half a kick to finish the body's last step and half a kick to start its next.
+			const StorageReal kickTime = unitTime *
+				static_cast<StorageReal>(levelStepUnits(level) + levelStepUnits(newLevel)) / 2;
+
+			m_velocities[index] += Vec2_t<StorageReal>(m_accelerations[index]) * kickTime;
+			m_timestepLevels[index] = newLevel;
+		});
 
-		DrawTexturePro(
-		   m_circleTex,
-		   { 0, 0, static_cast<float>(m_circleTex.width), static_cast<float>(m_circleTex.height) },
-		   { position.x, position.y, diameter, diameter },
-		   { radius, radius },
-		   0.0f,
-		   bodyColor
-	   );
+		// Next sub-step is when the shortest occupied level is next due. Every body drifts up to it, which predicts
+		// where the inactive ones are for the forces on the active ones.
+		const int shortestLevel = std::reduce(std::execution::par_unseq, m_timestepLevels.begin(),
+			m_timestepLevels.end(), uint8_t{0}, [](const uint8_t a, const uint8_t b) { return std::max(a, b); });
+		const uint32_t shortestUnits = levelStepUnits(shortestLevel);
+		const uint32_t nextTime = (time / shortestUnits + 1) * shortestUnits;
+		const StorageReal driftTime = unitTime * static_cast<StorageReal>(nextTime - time);
+
+		forEachBody([&](const BodyIndex_t index)
+		{
+			m_positions[index] += m_velocities[index] * driftTime;
+		});
+
+		updateQuadTree();
+		time = nextTime;
 	}
+}
+
+// Fills instances from a snapshot's bodies in parallel, colored by colorOf(velocity).
+template <typename ColorOf>
+static void fillBodyInstances(const std::vector<glm::vec2>& positions, const std::vector<glm::vec2>& velocities,
+	const std::vector<float>& diameters, std::vector<BodyInstance>& instances, ColorOf colorOf)
+{
+	instances.resize(positions.size());
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, positions.size()), [&](const tbb::blocked_range<size_t>& range)
+	{
+		for (size_t i = range.begin(); i < range.end(); ++i)
+			instances[i] = {positions[i], diameters[i], colorOf(velocities[i])};
+	});
+}
 
-	if (m_visualizeQuadTree)
-		m_quadTree.visualize(m_camera.zoom);
-	EndMode2D();
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::updateBodyInstances()
+{
+	const Snapshot& snapshot = frontSnapshot();
+	if (snapshot.step == m_bodyInstancesStep && g_colormapMode == m_bodyInstancesColormapMode)
+		return;
 
-	if (m_showDetails)
-		drawDetails();
+	ScopedTimer timer(TimingPhase::BodyInstances);
 
-	if (m_showControls)
-		drawControls();
-	else
-		drawTextRJust("Press C to show controls",
-			static_cast<int>(g_screenDims.x - 5), static_cast<int>(g_screenDims.y - 25), 20, WHITE);
+	const auto fill = [&](const auto colorOf)
+	{
+		fillBodyInstances(snapshot.positions, snapshot.velocities, snapshot.diameters, m_bodyInstances, colorOf);
+	};
+	const auto alpha = static_cast<unsigned char>(g_bodyAlpha);
+
+	switch (g_colormapMode)
+	{
+	case ColormapMode::None:
+		fill([&](const glm::vec2) { return Color{g_bodyColor.r, g_bodyColor.g, g_bodyColor.b, alpha}; });
+		break;
+
+	case ColormapMode::Speed:
+		fill([&](const glm::vec2 velocity)
+		{
+			const int colormapIndex =
+				std::clamp(static_cast<int>(glm::length2(velocity) / g_colormapMaxSqrSpeed * SPEED_COLORMAP_SIZE),
+					0, SPEED_COLORMAP_SIZE - 1);
+			const auto [r, g, b] = SPEED_COLORMAP_ARRAY[colormapIndex];
+			return Color{r, g, b, alpha};
+		});
+		break;
+
+	case ColormapMode::Velocity:
+		fill([&](const glm::vec2 velocity)
+		{
+			const float angle = atan2f(velocity.y, velocity.x) + PI;
+			const int colormapIndex =
+				std::clamp(static_cast<int>(angle / (2 * PI) * VELOCITY_COLORMAP_SIZE),
+					0, VELOCITY_COLORMAP_SIZE - 1);
+			const auto [r, g, b] = VELOCITY_COLORMAP_ARRAY[colormapIndex];
+			return Color{r, g, b, alpha};
+		});
+		break;
+
+	// Unreachable.
+	default:
+		throw std::runtime_error(std::format("Unknown colormap mode '{}'.", colormapModeToString(g_colormapMode)));
+	}
+
+	m_bodyRenderer.setInstances(m_bodyInstances);
+	m_bodyInstancesStep = snapshot.step;
+	m_bodyInstancesColormapMode = g_colormapMode;
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::draw()
+{
+	const Snapshot& snapshot = frontSnapshot();
+	updateBodyInstances();
+
+	BeginDrawing();
+
+	// EndDrawing waits out the rest of the frame, so it's left out.
+	{
+		ScopedTimer timer(TimingPhase::Draw);
+
+		ClearBackground(BLACK);
+
+		BeginMode2D(m_camera);
+		m_bodyRenderer.draw();
+
+		if (m_visualizeQuadTree)
+			QuadTree<ForceReal>::visualize(snapshot.treeCells, m_camera.zoom);
+		EndMode2D();
+
+		if (m_showDetails)
+		{
+			drawDetails();
+			drawTimings();
+		}
+
+		if (m_showControls)
+			drawControls();
+		else
+			drawTextRJust("Press C to show controls",
+				static_cast<int>(g_screenDims.x - 5), static_cast<int>(g_screenDims.y - 25), 20, WHITE);
+
+		DrawFPS(5, 5);
+	}
 
-	DrawFPS(5, 5);
 	EndDrawing();
 }
 
-void Sim::drawDetails() const
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::drawDetails() const
 {
 	int y = 5;
 
@@ -271,12 +870,64 @@ void Sim::drawDetails() const
 	DRAW_DETAIL("Timescale", g_timeScale);
 	DRAW_DETAIL("Target FPS", g_targetFPS);
 	DRAW_DETAIL("Theta", g_theta);
-	DRAW_DETAIL("N", m_positions.size());
+	if (g_solver == Solver::FMM)
+		DRAW_DETAIL("FMM order/theta", std::format("{}/{}", g_fmmOrder, g_fmmTheta));
+	DRAW_DETAIL("Tree builder", treeBuilderToString(g_treeBuilder));
+	DRAW_DETAIL("Tree rebuild interval", g_treeRebuildInterval);
+	DRAW_DETAIL("Leaf size", g_leafSize);
+	DRAW_DETAIL("Integrator", integratorToString(g_integrator));
+	DRAW_DETAIL("Force evaluations per step", integratorScheme(g_integrator).forceEvaluations());
+	DRAW_DETAIL("Block timestep levels", g_blockTimestepLevels);
+	DRAW_DETAIL("Force traversal", forceTraversalToString(g_forceTraversal));
+	DRAW_DETAIL("Solver", solverToString(frontSnapshot().solver));
+	DRAW_DETAIL("Kernel instruction set", kernelInstructionSet());
+	DRAW_DETAIL("Precision", precisionToString(g_precision));
+	DRAW_DETAIL("N", frontSnapshot().positions.size());
+	DRAW_DETAIL("Step", frontSnapshot().step);
+	if (m_trajectoryWriter)
+		DRAW_DETAIL("Trajectory frames written/dropped", std::format("{}/{}", m_trajectoryWriter->getWrittenFrames(),
+			m_trajectoryWriter->getDroppedFrames()));
 
 #undef DRAW_DETAIL
 }
 
-void Sim::drawControls()
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::drawTimings() const
+{
+	int y = 5;
+
+	// Below the FPS counter.
+	for (int i = 0; i < TIMING_PHASE_COUNT; ++i)
+	{
+		const auto phase = static_cast<TimingPhase>(i);
+		DrawText(std::format("{} = {:.2f} ms", timingPhaseToString(phase), g_timings.averagePhaseTime(phase)).c_str(),
+			5, y += 20, 20, WHITE);
+	}
+	DrawText(std::format("Frame = {:.2f} ms", g_timings.averageFrameTime()).c_str(), 5, y += 20, 20, WHITE);
+
+	const auto& history = g_timings.getFrameHistory();
+	const int graphY = y + 25;
+	const float targetFrameTime = 1000.0f / static_cast<float>(g_targetFPS);
+	const float pixelsPerMillisecond = TIMING_GRAPH_HEIGHT / (2 * targetFrameTime);
+
+	DrawRectangle(5, graphY, TIMING_HISTORY_SIZE * TIMING_GRAPH_BAR_WIDTH, TIMING_GRAPH_HEIGHT,
+		TIMING_GRAPH_BACKGROUND_COLOR);
+
+	for (int i = 0; i < TIMING_HISTORY_SIZE; ++i)
+	{
+		const float frameTime = history[(g_timings.getFrameHistoryStart() + i) % TIMING_HISTORY_SIZE];
+		const int barHeight = std::min(static_cast<int>(frameTime * pixelsPerMillisecond), TIMING_GRAPH_HEIGHT);
+
+		DrawRectangle(5 + i * TIMING_GRAPH_BAR_WIDTH, graphY + TIMING_GRAPH_HEIGHT - barHeight, TIMING_GRAPH_BAR_WIDTH,
+			barHeight, frameTime > targetFrameTime * TIMING_GRAPH_MISSED_FRAME_RATIO ? RED : GREEN);
+	}
+
+	DrawLine(5, graphY + TIMING_GRAPH_HEIGHT / 2, 5 + TIMING_HISTORY_SIZE * TIMING_GRAPH_BAR_WIDTH,
+		graphY + TIMING_GRAPH_HEIGHT / 2, WHITE);
+}
+
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::drawControls()
 {
 	int y = 5;
 
@@ -289,6 +940,7 @@ void Sim::drawControls()
 	DRAW_CONTROL("G", "Cycle colormap mode");
 	DRAW_CONTROL("R", "Reverse time");
 	DRAW_CONTROL("D", "Show sim details");
+	DRAW_CONTROL("K", "Save checkpoint");
 	DRAW_CONTROL("F", "Focus on system CoM");
 	DRAW_CONTROL("Comma/period", "Change time scale");
 	DRAW_CONTROL("Space or P", "Pause");
@@ -298,8 +950,14 @@ void Sim::drawControls()
 #undef DRAW_CONTROL
 }
 
-void Sim::drawTextRJust(const char* text, const int x, const int y, const int fontSize, const Color color)
+template <typename StorageReal, typename ForceReal>
+void Sim<StorageReal, ForceReal>::drawTextRJust(const char* text, const int x, const int y, const int fontSize,
+	const Color color)
 {
 	const int width = MeasureText(text, fontSize);
 	DrawText(text, x - width, y, fontSize, color);
 }
+
+template class Sim<float, float>;
+template class Sim<double, double>;
+template class Sim<double, float>;
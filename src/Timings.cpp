@@ -0,0 +1,105 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#include "Timings.hpp"
+
+#include <format>
+#include <stdexcept>
+#include <utility>
+
+// Weight of the latest frame in the moving averages, so they cover about the last 30 frames.
+static constexpr double TIMING_AVERAGE_WEIGHT = 1.0 / 30.0;
+
+Timings g_timings;
+
+const char* timingPhaseToString(const TimingPhase phase)
+{
+	switch (phase)
+	{
+	case TimingPhase::TreeBounds:    return "Tree bounds";
+	case TimingPhase::TreeSort:      return "Tree sort";
+	case TimingPhase::TreeNodes:     return "Tree nodes";
+	case TimingPhase::TreeLayout:    return "Tree layout";
+	case TimingPhase::TreeRefit:     return "Tree refit";
+	case TimingPhase::Reorder:       return "Reorder";
+	case TimingPhase::Forces:        return "Forces";
+	case TimingPhase::Integration:   return "Integration";
+	case TimingPhase::Trajectory:    return "Trajectory";
+	case TimingPhase::Snapshot:      return "Snapshot";
+	case TimingPhase::BodyInstances: return "Body instances";
+	case TimingPhase::Draw:          return "Draw";
+	}
+
+	return "Unknown"; // Unreachable.
+}
+
+void Timings::addPhaseTime(const TimingPhase phase, const double milliseconds)
+{
+	std::lock_guard lock(m_mutex);
+	m_framePhaseTimes[static_cast<int>(phase)] += milliseconds;
+}
+
+void Timings::endFrame()
+{
+	const auto now = std::chrono::steady_clock::now();
+	const double frameTime = std::chrono::duration<double, std::milli>(now - m_lastFrameEnd).count();
+	m_lastFrameEnd = now;
+
+	std::array<double, TIMING_PHASE_COUNT> phaseTimes;
+	{
+		std::lock_guard lock(m_mutex);
+		phaseTimes = std::exchange(m_framePhaseTimes, {});
+	}
+
+	// The first frame starts the averages off rather than being faded in from 0.
+	const double weight = m_frameCount == 0 ? 1 : TIMING_AVERAGE_WEIGHT;
+	for (int i = 0; i < TIMING_PHASE_COUNT; ++i)
+		m_averagePhaseTimes[i] += (phaseTimes[i] - m_averagePhaseTimes[i]) * weight;
+	m_averageFrameTime += (frameTime - m_averageFrameTime) * weight;
+
+	m_frameHistory[m_frameHistoryStart] = static_cast<float>(frameTime);
+	m_frameHistoryStart = (m_frameHistoryStart + 1) % TIMING_HISTORY_SIZE;
+
+	if (m_csv.is_open())
+	{
+		m_csv << m_frameCount << ',' << frameTime;
+		for (const double phaseTime : phaseTimes)
+			m_csv << ',' << phaseTime;
+		m_csv << '\n';
+	}
+
+	++m_frameCount;
+}
+
+void Timings::openCsv(const char* path)
+{
+	m_csv.open(path);
+	if (!m_csv.is_open())
+		throw std::runtime_error(std::format("Failed to open timings file given path {}.", path));
+
+	m_csv << "frame,frame_ms";
+	for (int i = 0; i < TIMING_PHASE_COUNT; ++i)
+		m_csv << ",\"" << timingPhaseToString(static_cast<TimingPhase>(i)) << " ms\"";
+	m_csv << '\n';
+}
+
+double Timings::averagePhaseTime(const TimingPhase phase) const
+{
+	return m_averagePhaseTimes[static_cast<int>(phase)];
+}
+
+double Timings::averageFrameTime() const
+{
+	return m_averageFrameTime;
+}
+
+const std::array<float, TIMING_HISTORY_SIZE>& Timings::getFrameHistory() const
+{
+	return m_frameHistory;
+}
+
+int Timings::getFrameHistoryStart() const
+{
+	return m_frameHistoryStart;
+}
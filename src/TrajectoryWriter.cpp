@@ -0,0 +1,241 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#include "TrajectoryWriter.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <execution>
+#include <format>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+static constexpr std::array<char, 8> TRAJECTORY_MAGIC = {'G', 'R', 'A', 'V', 'T', 'R', 'A', 'J'};
+static constexpr uint32_t TRAJECTORY_BYTE_ORDER_MARK = 0x01020304;
+
+template <typename T>
+static void appendBytes(std::vector<char>& bytes, const T& value)
+{
+	const auto* first = reinterpret_cast<const char*>(&value);
+	bytes.insert(bytes.end(), first, first + sizeof(T));
+}
+
+// Appends value as a zigzag encoded LEB128 varint, so small differences either side of 0 take a single byte.
+static void appendVarint(std::vector<char>& bytes, const int64_t value)
+{
+	uint64_t zigzag = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+	while (zigzag >= 0x80)
+	{
+		bytes.push_back(static_cast<char>((zigzag & 0x7f) | 0x80));
+		zigzag >>= 7;
+	}
+	bytes.push_back(static_cast<char>(zigzag));
+}
+
+// A coordinate divided by the quantum and rounded, saturated at +-limit. Coordinates that aren't finite are flagged
+// with -limit - 1, as rounding or converting them is undefined.
+static int64_t quantize(const double coordinate, const double quantum, const int64_t limit)
+{
+	if (!std::isfinite(coordinate))
+		return -limit - 1;
+
+	const auto bound = static_cast<double>(limit);
+	return static_cast<int64_t>(std::clamp(std::round(coordinate / quantum), -bound, bound));
+}
+
+template <typename Real>
+TrajectoryWriter<Real>::TrajectoryWriter(const char* path, const size_t bodyCount) : m_file(path, std::ios::binary),
+	m_bodyCount(bodyCount), m_encoding(g_trajectoryEncoding), m_quantum(g_trajectoryQuantum),
+	m_backpressure(g_trajectoryBackpressure), m_frames(g_trajectoryBuffers)
+{
+	if (!m_file.is_open())
+		throw std::runtime_error(std::format("Failed to open trajectory file given path {}.", path));
+
+	TrajectoryHeader header = {};
+	header.magic = TRAJECTORY_MAGIC;
+	header.version = TRAJECTORY_VERSION;
+	header.byteOrderMark = TRAJECTORY_BYTE_ORDER_MARK;
+	header.bodyCount = bodyCount;
+	header.realSize = sizeof(Real);
+	header.encoding = static_cast<uint32_t>(m_encoding);
+	header.quantum = m_quantum;
+	m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	for (Frame& frame : m_frames)
+	{
+		frame.positions.resize(bodyCount);
+		frame.velocities.resize(bodyCount);
+		m_freeFrames.push_back(&frame);
+	}
+
+	m_indices.resize(bodyCount);
+	std::iota(m_indices.begin(), m_indices.end(), 0);
+
+	if (m_encoding == TrajectoryEncoding::Delta)
+		m_lastQuantized.resize(bodyCount);
+
+	m_thread = std::thread(&TrajectoryWriter::writeLoop, this);
+}
+
+template <typename Real>
+TrajectoryWriter<Real>::~TrajectoryWriter()
+{
+	{
+		std::lock_guard lock(m_mutex);
+		m_stopping = true;
+	}
+	m_frameQueued.notify_one();
+	m_thread.join();
+}
+
+template <typename Real>
+void TrajectoryWriter<Real>::submit(const uint64_t step, const double time, const std::vector<Vec2_t<Real>>& positions,
+	const std::vector<Vec2_t<Real>>& velocities, const std::vector<BodyIndex_t>& bodyIds)
+{
+	Frame* frame;
+	{
+		std::unique_lock lock(m_mutex);
+
+		if (m_error)
+			std::rethrow_exception(std::exchange(m_error, nullptr));
+
+		if (m_freeFrames.empty())
+		{
+			if (m_backpressure == TrajectoryBackpressure::Drop)
+			{
+				++m_droppedFrames;
+				return;
+			}
+
+			m_frameFreed.wait(lock, [this] { return !m_freeFrames.empty() || m_error; });
+			if (m_error)
+				std::rethrow_exception(std::exchange(m_error, nullptr));
+		}
+
+		frame = m_freeFrames.back();
+		m_freeFrames.pop_back();
+	}
+
+	// The frame is only touched here until it's queued, so it's filled without holding the lock.
+	frame->step = step;
+	frame->time = time;
+	std::for_each(std::execution::par_unseq, m_indices.begin(), m_indices.end(), [&](const BodyIndex_t index)
+	{
+		frame->positions[bodyIds[index]] = positions[index];
+		frame->velocities[bodyIds[index]] = velocities[index];
+	});
+
+	{
+		std::lock_guard lock(m_mutex);
+		m_queuedFrames.push_back(frame);
+	}
+	m_frameQueued.notify_one();
+}
+
+template <typename Real>
+uint64_t TrajectoryWriter<Real>::getWrittenFrames() const
+{
+	return m_writtenFrames;
+}
+
+template <typename Real>
+uint64_t TrajectoryWriter<Real>::getDroppedFrames() const
+{
+	return m_droppedFrames;
+}
+
+template <typename Real>
+void TrajectoryWriter<Real>::writeLoop()
+{
+	while (true)
+	{
+		Frame* frame;
+		{
+			std::unique_lock lock(m_mutex);
+			m_frameQueued.wait(lock, [this] { return !m_queuedFrames.empty() || m_stopping; });
+
+			// Only stops once everything queued has been written.
+			if (m_queuedFrames.empty())
+				break;
+
+			frame = m_queuedFrames.front();
+			m_queuedFrames.pop_front();
+		}
+
+		try
+		{
+			writeFrame(*frame);
+			++m_writtenFrames;
+		}
+		catch (...)
+		{
+			std::lock_guard lock(m_mutex);
+			m_error = std::current_exception();
+		}
+
+		{
+			std::lock_guard lock(m_mutex);
+			m_freeFrames.push_back(frame);
+		}
+		m_frameFreed.notify_one();
+	}
+
+	m_file.flush();
+}
+
+template <typename Real>
+void TrajectoryWriter<Real>::writeFrame(const Frame& frame)
+{
+	m_payload.clear();
+	encodePositions(frame);
+
+	const size_t velocitiesSize = m_bodyCount * sizeof(Vec2_t<Real>);
+	m_payload.resize(m_payload.size() + velocitiesSize);
+	std::memcpy(m_payload.data() + m_payload.size() - velocitiesSize, frame.velocities.data(), velocitiesSize);
+
+	const TrajectoryFrameHeader header = {frame.step, frame.time, m_payload.size()};
+	m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	m_file.write(m_payload.data(), static_cast<std::streamsize>(m_payload.size()));
+
+	if (!m_file)
+		throw std::runtime_error("Failed writing trajectory frame.");
+}
+
+template <typename Real>
+void TrajectoryWriter<Real>::encodePositions(const Frame& frame)
+{
+	static constexpr int64_t INT32_LIMIT = std::numeric_limits<int32_t>::max();
+
+	switch (m_encoding)
+	{
+	case TrajectoryEncoding::Raw:
+		m_payload.resize(m_bodyCount * sizeof(Vec2_t<Real>));
+		std::memcpy(m_payload.data(), frame.positions.data(), m_payload.size());
+		break;
+	case TrajectoryEncoding::Quantized:
+		m_payload.reserve(m_bodyCount * 2 * sizeof(int32_t));
+		for (const Vec2_t<Real>& position : frame.positions)
+		{
+			for (int axis = 0; axis < 2; ++axis)
+				appendBytes(m_payload, static_cast<int32_t>(quantize(position[axis], m_quantum, INT32_LIMIT)));
+		}
+		break;
+	case TrajectoryEncoding::Delta:
+		for (size_t i = 0; i < m_bodyCount; ++i)
+		{
+			for (int axis = 0; axis < 2; ++axis)
+			{
+				const int64_t quantized = quantize(frame.positions[i][axis], m_quantum, TRAJECTORY_DELTA_LIMIT);
+				appendVarint(m_payload, quantized - m_lastQuantized[i][axis]);
+				m_lastQuantized[i][axis] = quantized;
+			}
+		}
+		break;
+	}
+}
+
+template class TrajectoryWriter<float>;
+template class TrajectoryWriter<double>;
@@ -0,0 +1,408 @@
+//
+// Created by kassie on 17/10/2026.
+//
+
+#include "gravityKernels.hpp"
+
+#include "gravity.hpp"
+
+// Explicit kernels are written with GCC/Clang target attributes, so other compilers and architectures get the scalar
+// kernels only.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define GRAV_SIM_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+template <typename Real>
+void BodySources<Real>::clear()
+{
+	xs.clear();
+	ys.clear();
+	masses.clear();
+}
+
+template <typename Real>
+void BodySources<Real>::append(const Real* sourceXs, const Real* sourceYs, const Real* sourceMasses,
+	const size_t count)
+{
+	xs.insert(xs.end(), sourceXs, sourceXs + count);
+	ys.insert(ys.end(), sourceYs, sourceYs + count);
+	masses.insert(masses.end(), sourceMasses, sourceMasses + count);
+}
+
+template <typename Real>
+void NodeSources<Real>::clear()
+{
+	xs.clear();
+	ys.clear();
+	masses.clear();
+	momentXXs.clear();
+	momentXYs.clear();
+	momentYYs.clear();
+}
+
+template <typename Real>
+void NodeSources<Real>::push_back(const CoM<Real>& com)
+{
+	xs.push_back(com.position.x);
+	ys.push_back(com.position.y);
+	masses.push_back(com.mass);
+	momentXXs.push_back(com.momentXX);
+	momentXYs.push_back(com.momentXY);
+	momentYYs.push_back(com.momentYY);
+}
+
+template struct BodySources<float>;
+template struct BodySources<double>;
+template struct NodeSources<float>;
+template struct NodeSources<double>;
+
+// Scalar.
+
+template <typename Real>
+static Vec2_t<Real> bodyAccelSumScalar(const Vec2_t<Real> position, const Real* xs, const Real* ys, const Real* masses,
+	const size_t count, const ForceParams<Real> params)
+{
+	return withForceLaw(params, [&]<typename Law>()
+	{
+		Vec2_t<Real> accelSum = {};
+
+		for (size_t i = 0; i < count; ++i)
+			accelSum += gravAccel<Law>(position, {xs[i], ys[i]}, masses[i], params);
+
+		return accelSum;
+	});
+}
+
+template <typename Real>
+static Vec2_t<Real> nodeAccelSumScalar(const Vec2_t<Real> position, const NodeSources<Real>& sources,
+	const ForceParams<Real> params)
+{
+	return withForceLaw(params, [&]<typename Law>()
+	{
+		Vec2_t<Real> accelSum = {};
+
+		for (size_t i = 0; i < sources.xs.size(); ++i)
+		{
+			const CoM<Real> com = {{sources.xs[i], sources.ys[i]}, sources.masses[i],
+				sources.momentXXs[i], sources.momentXYs[i], sources.momentYYs[i]};
+			const Vec2_t<Real> rel = com.position - position;
+			const Real sqrDist = glm::length2(rel);
+
+			if (sqrDist > SQR_DIST_EPSILON)
+				accelSum += nodeGravAccel<Law>(rel, sqrDist, com, params);
+		}
+
+		return accelSum;
+	});
+}
+
+#ifdef GRAV_SIM_X86_KERNELS
+
+// AVX2, 8 lanes. Tails are loaded with a lane mask, and masked lanes load zero masses and moments so they add nothing.
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+AVX2_TARGET static __m256 avx2TailMask(const size_t remaining)
+{
+	static constexpr int LANES[16] = {-1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0};
+	return _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(LANES + 8 - remaining)));
+}
+
+AVX2_TARGET static float avx2Sum(const __m256 value)
+{
+	const __m128 half = _mm_add_ps(_mm256_castps256_ps128(value), _mm256_extractf128_ps(value, 1));
+	const __m128 quarter = _mm_add_ps(half, _mm_movehl_ps(half, half));
+	return _mm_cvtss_f32(_mm_add_ss(quarter, _mm_shuffle_ps(quarter, quarter, 1)));
+}
+
+// 1 / sqrt(sqrDist) from the approximate reciprocal square root and a Newton step.
+AVX2_TARGET static __m256 avx2InvSqrt(const __m256 sqrDist)
+{
+	const __m256 estimate = _mm256_rsqrt_ps(sqrDist);
+	const __m256 halfSqrDist = _mm256_mul_ps(_mm256_set1_ps(0.5f), sqrDist);
+	const __m256 correction = _mm256_fnmadd_ps(halfSqrDist, _mm256_mul_ps(estimate, estimate), _mm256_set1_ps(1.5f));
+	return _mm256_mul_ps(estimate, correction);
+}
+
+AVX2_TARGET static void avx2AccumulateBodies(const __m256 positionX, const __m256 positionY, const __m256 x,
+	const __m256 y, const __m256 mass, const __m256 gravSmoothness, __m256& sumX, __m256& sumY)
+{
+	const __m256 relX = _mm256_sub_ps(x, positionX);
+	const __m256 relY = _mm256_sub_ps(y, positionY);
+	const __m256 sqrDist = _mm256_fmadd_ps(relX, relX, _mm256_mul_ps(relY, relY));
+
+	const __m256 softSqrDist = _mm256_add_ps(gravSmoothness, sqrDist);
+	__m256 scale = _mm256_div_ps(_mm256_mul_ps(mass, avx2InvSqrt(sqrDist)), softSqrDist);
+
+	// Close pairs give infs and NaNs above, which are masked to zero rather than branched around.
+	scale = _mm256_and_ps(scale, _mm256_cmp_ps(sqrDist, _mm256_set1_ps(SQR_DIST_EPSILON), _CMP_GT_OQ));
+
+	sumX = _mm256_fmadd_ps(scale, relX, sumX);
+	sumY = _mm256_fmadd_ps(scale, relY, sumY);
+}
+
+AVX2_TARGET static glm::vec2 bodyAccelSumAVX2(const glm::vec2 position, const float* xs, const float* ys,
+	const float* masses, const size_t count, const ForceParams<float> params)
+{
+	const __m256 positionX = _mm256_set1_ps(position.x);
+	const __m256 positionY = _mm256_set1_ps(position.y);
+	const __m256 gravSmoothness = _mm256_set1_ps(params.gravSmoothness);
+	__m256 sumX = _mm256_setzero_ps();
+	__m256 sumY = _mm256_setzero_ps();
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+		avx2AccumulateBodies(positionX, positionY, _mm256_loadu_ps(xs + i), _mm256_loadu_ps(ys + i),
+			_mm256_loadu_ps(masses + i), gravSmoothness, sumX, sumY);
+
+	if (i < count)
+	{
+		const __m256i mask = _mm256_castps_si256(avx2TailMask(count - i));
+		avx2AccumulateBodies(positionX, positionY, _mm256_maskload_ps(xs + i, mask), _mm256_maskload_ps(ys + i, mask),
+			_mm256_maskload_ps(masses + i, mask), gravSmoothness, sumX, sumY);
+	}
+
+	return glm::vec2{avx2Sum(sumX), avx2Sum(sumY)} * params.gravConst;
+}
+
+AVX2_TARGET static void avx2AccumulateNodes(const __m256 positionX, const __m256 positionY, const float* xs,
+	const float* ys, const float* masses, const float* momentXXs, const float* momentXYs, const float* momentYYs,
+	const __m256i mask, const __m256 gravSmoothness, __m256& sumX, __m256& sumY)
+{
+	const __m256 relX = _mm256_sub_ps(_mm256_maskload_ps(xs, mask), positionX);
+	const __m256 relY = _mm256_sub_ps(_mm256_maskload_ps(ys, mask), positionY);
+	const __m256 mass = _mm256_maskload_ps(masses, mask);
+	const __m256 momentXX = _mm256_maskload_ps(momentXXs, mask);
+	const __m256 momentXY = _mm256_maskload_ps(momentXYs, mask);
+	const __m256 momentYY = _mm256_maskload_ps(momentYYs, mask);
+
+	const __m256 sqrDist = _mm256_fmadd_ps(relX, relX, _mm256_mul_ps(relY, relY));
+	const __m256 invDist = avx2InvSqrt(sqrDist);
+	const __m256 invSqrDist = _mm256_mul_ps(invDist, invDist);
+	const __m256 invSoftSqrDist = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_add_ps(gravSmoothness, sqrDist));
+	const __m256 sum = _mm256_fmadd_ps(_mm256_set1_ps(2.0f), invSoftSqrDist, invSqrDist);
+
+	// Same derivatives as nodeGravAccel.
+	const __m256 firstDeriv = _mm256_mul_ps(invDist, invSoftSqrDist);
+	const __m256 secondDeriv = _mm256_mul_ps(_mm256_sub_ps(_mm256_setzero_ps(), firstDeriv), sum);
+	__m256 thirdFactor = _mm256_mul_ps(sum, sum);
+	thirdFactor = _mm256_fmadd_ps(_mm256_set1_ps(2.0f), _mm256_mul_ps(invSqrDist, invSqrDist), thirdFactor);
+	thirdFactor = _mm256_fmadd_ps(_mm256_set1_ps(4.0f), _mm256_mul_ps(invSoftSqrDist, invSoftSqrDist), thirdFactor);
+	const __m256 thirdDeriv = _mm256_mul_ps(firstDeriv, thirdFactor);
+
+	const __m256 momentRelX = _mm256_fmadd_ps(momentXX, relX, _mm256_mul_ps(momentXY, relY));
+	const __m256 momentRelY = _mm256_fmadd_ps(momentXY, relX, _mm256_mul_ps(momentYY, relY));
+	const __m256 relMomentRel = _mm256_fmadd_ps(relX, momentRelX, _mm256_mul_ps(relY, momentRelY));
+	const __m256 trace = _mm256_add_ps(momentXX, momentYY);
+
+	// monopole + 0.5 * (thirdDeriv * relMomentRel * rel + secondDeriv * (trace * rel + 2 * momentRel)), gathered into
+	// a factor of rel and a factor of momentRel.
+	const __m256 relFactor = _mm256_fmadd_ps(mass, firstDeriv, _mm256_mul_ps(_mm256_set1_ps(0.5f),
+		_mm256_fmadd_ps(thirdDeriv, relMomentRel, _mm256_mul_ps(secondDeriv, trace))));
+	const __m256 valid = _mm256_cmp_ps(sqrDist, _mm256_set1_ps(SQR_DIST_EPSILON), _CMP_GT_OQ);
+	const __m256 maskedRelFactor = _mm256_and_ps(relFactor, valid);
+	const __m256 maskedSecondDeriv = _mm256_and_ps(secondDeriv, valid);
+
+	sumX = _mm256_fmadd_ps(maskedRelFactor, relX, _mm256_fmadd_ps(maskedSecondDeriv, momentRelX, sumX));
+	sumY = _mm256_fmadd_ps(maskedRelFactor, relY, _mm256_fmadd_ps(maskedSecondDeriv, momentRelY, sumY));
+}
+
+AVX2_TARGET static glm::vec2 nodeAccelSumAVX2(const glm::vec2 position, const NodeSources<float>& sources,
+	const ForceParams<float> params)
+{
+	const __m256 positionX = _mm256_set1_ps(position.x);
+	const __m256 positionY = _mm256_set1_ps(position.y);
+	const __m256 gravSmoothness = _mm256_set1_ps(params.gravSmoothness);
+	const __m256i allLanes = _mm256_set1_epi32(-1);
+	__m256 sumX = _mm256_setzero_ps();
+	__m256 sumY = _mm256_setzero_ps();
+
+	const size_t count = sources.xs.size();
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
+		avx2AccumulateNodes(positionX, positionY, &sources.xs[i], &sources.ys[i], &sources.masses[i],
+			&sources.momentXXs[i], &sources.momentXYs[i], &sources.momentYYs[i], allLanes, gravSmoothness, sumX, sumY);
+
+	if (i < count)
+		avx2AccumulateNodes(positionX, positionY, &sources.xs[i], &sources.ys[i], &sources.masses[i],
+			&sources.momentXXs[i], &sources.momentXYs[i], &sources.momentYYs[i],
+			_mm256_castps_si256(avx2TailMask(count - i)), gravSmoothness, sumX, sumY);
+
+	return glm::vec2{avx2Sum(sumX), avx2Sum(sumY)} * params.gravConst;
+}
+
+// AVX-512, 16 lanes. Same as AVX2, with tails and close pairs handled by mask registers.
+
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+AVX512_TARGET static __m512 avx512InvSqrt(const __m512 sqrDist)
+{
+	const __m512 estimate = _mm512_rsqrt14_ps(sqrDist);
+	const __m512 halfSqrDist = _mm512_mul_ps(_mm512_set1_ps(0.5f), sqrDist);
+	const __m512 correction = _mm512_fnmadd_ps(halfSqrDist, _mm512_mul_ps(estimate, estimate), _mm512_set1_ps(1.5f));
+	return _mm512_mul_ps(estimate, correction);
+}
+
+AVX512_TARGET static void avx512AccumulateBodies(const __m512 positionX, const __m512 positionY, const float* xs,
+	const float* ys, const float* masses, const __mmask16 mask, const __m512 gravSmoothness, __m512& sumX,
+	__m512& sumY)
+{
+	const __m512 relX = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, xs), positionX);
+	const __m512 relY = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, ys), positionY);
+	const __m512 mass = _mm512_maskz_loadu_ps(mask, masses);
+	const __m512 sqrDist = _mm512_fmadd_ps(relX, relX, _mm512_mul_ps(relY, relY));
+
+	const __m512 softSqrDist = _mm512_add_ps(gravSmoothness, sqrDist);
+	const __mmask16 valid = _mm512_cmp_ps_mask(sqrDist, _mm512_set1_ps(SQR_DIST_EPSILON), _CMP_GT_OQ);
+	const __m512 scale = _mm512_maskz_div_ps(valid, _mm512_mul_ps(mass, avx512InvSqrt(sqrDist)), softSqrDist);
+
+	sumX = _mm512_fmadd_ps(scale, relX, sumX);
+	sumY = _mm512_fmadd_ps(scale, relY, sumY);
+}
+
+AVX512_TARGET static glm::vec2 bodyAccelSumAVX512(const glm::vec2 position, const float* xs, const float* ys,
+	const float* masses, const size_t count, const ForceParams<float> params)
+{
+	const __m512 positionX = _mm512_set1_ps(position.x);
+	const __m512 positionY = _mm512_set1_ps(position.y);
+	const __m512 gravSmoothness = _mm512_set1_ps(params.gravSmoothness);
+	__m512 sumX = _mm512_setzero_ps();
+	__m512 sumY = _mm512_setzero_ps();
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+		avx512AccumulateBodies(positionX, positionY, xs + i, ys + i, masses + i, 0xffff, gravSmoothness, sumX, sumY);
+
+	if (i < count)
+		avx512AccumulateBodies(positionX, positionY, xs + i, ys + i, masses + i,
+			static_cast<__mmask16>((1u << (count - i)) - 1), gravSmoothness, sumX, sumY);
+
+	return glm::vec2{_mm512_reduce_add_ps(sumX), _mm512_reduce_add_ps(sumY)} * params.gravConst;
+}
+
+AVX512_TARGET static void avx512AccumulateNodes(const __m512 positionX, const __m512 positionY, const float* xs,
+	const float* ys, const float* masses, const float* momentXXs, const float* momentXYs, const float* momentYYs,
+	const __mmask16 mask, const __m512 gravSmoothness, __m512& sumX, __m512& sumY)
+{
+	const __m512 relX = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, xs), positionX);
+	const __m512 relY = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, ys), positionY);
+	const __m512 mass = _mm512_maskz_loadu_ps(mask, masses);
+	const __m512 momentXX = _mm512_maskz_loadu_ps(mask, momentXXs);
+	const __m512 momentXY = _mm512_maskz_loadu_ps(mask, momentXYs);
+	const __m512 momentYY = _mm512_maskz_loadu_ps(mask, momentYYs);
+
+	const __m512 sqrDist = _mm512_fmadd_ps(relX, relX, _mm512_mul_ps(relY, relY));
+	const __m512 invDist = avx512InvSqrt(sqrDist);
+	const __m512 invSqrDist = _mm512_mul_ps(invDist, invDist);
+	const __m512 invSoftSqrDist = _mm512_div_ps(_mm512_set1_ps(1.0f), _mm512_add_ps(gravSmoothness, sqrDist));
+	const __m512 sum = _mm512_fmadd_ps(_mm512_set1_ps(2.0f), invSoftSqrDist, invSqrDist);
+
+	const __m512 firstDeriv = _mm512_mul_ps(invDist, invSoftSqrDist);
+	const __m512 secondDeriv = _mm512_mul_ps(_mm512_sub_ps(_mm512_setzero_ps(), firstDeriv), sum);
+	__m512 thirdFactor = _mm512_mul_ps(sum, sum);
+	thirdFactor = _mm512_fmadd_ps(_mm512_set1_ps(2.0f), _mm512_mul_ps(invSqrDist, invSqrDist), thirdFactor);
+	thirdFactor = _mm512_fmadd_ps(_mm512_set1_ps(4.0f), _mm512_mul_ps(invSoftSqrDist, invSoftSqrDist), thirdFactor);
+	const __m512 thirdDeriv = _mm512_mul_ps(firstDeriv, thirdFactor);
+
+	const __m512 momentRelX = _mm512_fmadd_ps(momentXX, relX, _mm512_mul_ps(momentXY, relY));
+	const __m512 momentRelY = _mm512_fmadd_ps(momentXY, relX, _mm512_mul_ps(momentYY, relY));
+	const __m512 relMomentRel = _mm512_fmadd_ps(relX, momentRelX, _mm512_mul_ps(relY, momentRelY));
+	const __m512 trace = _mm512_add_ps(momentXX, momentYY);
+
+	const __mmask16 valid = _mm512_cmp_ps_mask(sqrDist, _mm512_set1_ps(SQR_DIST_EPSILON), _CMP_GT_OQ);
+	const __m512 relFactor = _mm512_maskz_fmadd_ps(valid, mass, firstDeriv, _mm512_mul_ps(_mm512_set1_ps(0.5f),
+		_mm512_fmadd_ps(thirdDeriv, relMomentRel, _mm512_mul_ps(secondDeriv, trace))));
+	const __m512 maskedSecondDeriv = _mm512_maskz_mov_ps(valid, secondDeriv);
+
+	sumX = _mm512_fmadd_ps(relFactor, relX, _mm512_fmadd_ps(maskedSecondDeriv, momentRelX, sumX));
+	sumY = _mm512_fmadd_ps(relFactor, relY, _mm512_fmadd_ps(maskedSecondDeriv, momentRelY, sumY));
+}
+
+AVX512_TARGET static glm::vec2 nodeAccelSumAVX512(const glm::vec2 position, const NodeSources<float>& sources,
+	const ForceParams<float> params)
+{
+	const __m512 positionX = _mm512_set1_ps(position.x);
+	const __m512 positionY = _mm512_set1_ps(position.y);
+	const __m512 gravSmoothness = _mm512_set1_ps(params.gravSmoothness);
+	__m512 sumX = _mm512_setzero_ps();
+	__m512 sumY = _mm512_setzero_ps();
+
+	const size_t count = sources.xs.size();
+	for (size_t i = 0; i < count; i += 16)
+	{
+		const auto mask = count - i >= 16 ? static_cast<__mmask16>(0xffff) :
+			static_cast<__mmask16>((1u << (count - i)) - 1);
+
+		avx512AccumulateNodes(positionX, positionY, &sources.xs[i], &sources.ys[i], &sources.masses[i],
+			&sources.momentXXs[i], &sources.momentXYs[i], &sources.momentYYs[i], mask, gravSmoothness, sumX, sumY);
+	}
+
+	return glm::vec2{_mm512_reduce_add_ps(sumX), _mm512_reduce_add_ps(sumY)} * params.gravConst;
+}
+
+#endif
+
+struct Kernels
+{
+	const char* instructionSet;
+	glm::vec2 (*bodyAccelSum)(glm::vec2, const float*, const float*, const float*, size_t, ForceParams<float>);
+	glm::vec2 (*nodeAccelSum)(glm::vec2, const NodeSources<float>&, ForceParams<float>);
+};
+
+static Kernels selectKernels()
+{
+#ifdef GRAV_SIM_X86_KERNELS
+	// Needed as this runs during static initialization.
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f"))
+		return {"AVX-512", bodyAccelSumAVX512, nodeAccelSumAVX512};
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return {"AVX2", bodyAccelSumAVX2, nodeAccelSumAVX2};
+#endif
+
+	return {"Scalar", bodyAccelSumScalar<float>, nodeAccelSumScalar<float>};
+}
+
+static const Kernels KERNELS = selectKernels();
+
+glm::vec2 bodyAccelSum(const glm::vec2 position, const float* xs, const float* ys, const float* masses,
+	const size_t count, const ForceParams<float> params)
+{
+	return KERNELS.bodyAccelSum(position, xs, ys, masses, count, params);
+}
+
+glm::dvec2 bodyAccelSum(const glm::dvec2 position, const double* xs, const double* ys, const double* masses,
+	const size_t count, const ForceParams<double> params)
+{
+	return bodyAccelSumScalar(position, xs, ys, masses, count, params);
+}
+
+glm::vec2 bodyAccelSum(const glm::vec2 position, const BodySources<float>& sources, const ForceParams<float> params)
+{
+	return bodyAccelSum(position, sources.xs.data(), sources.ys.data(), sources.masses.data(), sources.xs.size(),
+		params);
+}
+
+glm::dvec2 bodyAccelSum(const glm::dvec2 position, const BodySources<double>& sources, const ForceParams<double> params)
+{
+	return bodyAccelSum(position, sources.xs.data(), sources.ys.data(), sources.masses.data(), sources.xs.size(),
+		params);
+}
+
+glm::vec2 nodeAccelSum(const glm::vec2 position, const NodeSources<float>& sources, const ForceParams<float> params)
+{
+	return KERNELS.nodeAccelSum(position, sources, params);
+}
+
+glm::dvec2 nodeAccelSum(const glm::dvec2 position, const NodeSources<double>& sources, const ForceParams<double> params)
+{
+	return nodeAccelSumScalar(position, sources, params);
+}
+
+const char* kernelInstructionSet()
+{
+	return KERNELS.instructionSet;
+}
@@ -21,6 +21,86 @@ const char* colormapModeToString(const ColormapMode mode)
     return "Unknown"; // Unreachable.
 }
 
+const char* treeBuilderToString(const TreeBuilder builder)
+{
+    switch (builder)
+    {
+        case TreeBuilder::Partition: return "Partition";
+        case TreeBuilder::Morton:    return "Morton";
+    }
+
+    return "Unknown"; // Unreachable.
+}
+
+const char* forceTraversalToString(const ForceTraversal traversal)
+{
+    switch (traversal)
+    {
+        case ForceTraversal::Body:  return "Body";
+        case ForceTraversal::Group: return "Group";
+    }
+
+    return "Unknown"; // Unreachable.
+}
+
+const char* solverToString(const Solver solver)
+{
+    switch (solver)
+    {
+        case Solver::BarnesHut: return "Barnes-Hut";
+        case Solver::FMM:       return "FMM";
+        case Solver::Direct:    return "Direct";
+    }
+
+    return "Unknown"; // Unreachable.
+}
+
+const char* precisionToString(const Precision precision)
+{
+    switch (precision)
+    {
+        case Precision::Float:  return "Float";
+        case Precision::Double: return "Double";
+        case Precision::Mixed:  return "Mixed";
+    }
+
+    return "Unknown"; // Unreachable.
+}
+
+const char* integratorToString(const Integrator integrator)
+{
+    switch (integrator)
+    {
+        case Integrator::Leapfrog:   return "Leapfrog";
+        case Integrator::ForestRuth: return "Forest-Ruth";
+    }
+
+    return "Unknown"; // Unreachable.
+}
+
+const char* trajectoryEncodingToString(const TrajectoryEncoding encoding)
+{
+    switch (encoding)
+    {
+        case TrajectoryEncoding::Raw:       return "Raw";
+        case TrajectoryEncoding::Quantized: return "Quantized";
+        case TrajectoryEncoding::Delta:     return "Delta";
+    }
+
+    return "Unknown"; // Unreachable.
+}
+
+const char* trajectoryBackpressureToString(const TrajectoryBackpressure backpressure)
+{
+    switch (backpressure)
+    {
+        case TrajectoryBackpressure::Block: return "Block";
+        case TrajectoryBackpressure::Drop:  return "Drop";
+    }
+
+    return "Unknown"; // Unreachable.
+}
+
 float g_theta;
 float g_gravConst;
 float g_gravSmoothness;
@@ -34,6 +114,26 @@ int g_bodyAlpha;
 ColormapMode g_colormapMode;
 float g_colormapMaxSpeed;
 float g_colormapMaxSqrSpeed;
+TreeBuilder g_treeBuilder;
+int g_treeRebuildInterval;
+float g_treeRefitMaxGrowth;
+int g_leafSize;
+ForceTraversal g_forceTraversal;
+int g_groupSize;
+Solver g_solver;
+int g_fmmOrder;
+float g_fmmTheta;
+bool g_reorderBodies;
+Precision g_precision;
+int g_blockTimestepLevels;
+float g_blockTimestepTolerance;
+Integrator g_integrator;
+int g_directSumMaxBodies;
+int g_trajectoryInterval;
+TrajectoryEncoding g_trajectoryEncoding;
+float g_trajectoryQuantum;
+int g_trajectoryBuffers;
+TrajectoryBackpressure g_trajectoryBackpressure;
 
 void loadSimulationFile(const char* simulationPath)
 {
@@ -41,6 +141,11 @@ void loadSimulationFile(const char* simulationPath)
     if (!file.is_open())
         throw std::runtime_error(std::format("Failed to open simulation config file given path {}.", simulationPath));
 
+    loadSimulationParameters(file);
+}
+
+void loadSimulationParameters(std::istream& file)
+{
     bool thetaFound = false;
     bool gravConstFound = false;
     bool gravSmoothnessFound = false;
@@ -52,6 +157,26 @@ void loadSimulationFile(const char* simulationPath)
     bool bodyAlphaFound = false;
     bool colormapModeFound = false;
     bool colormapMaxSpeedFound = false;
+    bool treeBuilderFound = false;
+    bool treeRebuildIntervalFound = false;
+    bool treeRefitMaxGrowthFound = false;
+    bool leafSizeFound = false;
+    bool forceTraversalFound = false;
+    bool groupSizeFound = false;
+    bool solverFound = false;
+    bool fmmOrderFound = false;
+    bool fmmThetaFound = false;
+    bool reorderBodiesFound = false;
+    bool precisionFound = false;
+    bool blockTimestepLevelsFound = false;
+    bool blockTimestepToleranceFound = false;
+    bool integratorFound = false;
+    bool directSumMaxBodiesFound = false;
+    bool trajectoryIntervalFound = false;
+    bool trajectoryEncodingFound = false;
+    bool trajectoryQuantumFound = false;
+    bool trajectoryBuffersFound = false;
+    bool trajectoryBackpressureFound = false;
 
     int lineNum = 0;
     std::string line;
@@ -137,6 +262,161 @@ void loadSimulationFile(const char* simulationPath)
         }
         else if (parameter == "COLORMAPMAXSPEED")
             READ_PARAMETER("COLORMAPMAXSPEED", colormapMaxSpeedFound, g_colormapMaxSpeed);
+        else if (parameter == "TREEBUILDER")
+        {
+            if (treeBuilderFound)
+                throw std::runtime_error(std::format("Double definition of TREEBUILDER on line {}.", lineNum));
+
+            std::string treeBuilder;
+            ss >> treeBuilder;
+
+            if (treeBuilder == "PARTITION")
+                g_treeBuilder = TreeBuilder::Partition;
+            else if (treeBuilder == "MORTON")
+                g_treeBuilder = TreeBuilder::Morton;
+            else
+                throw std::runtime_error(std::format("Unknown tree builder '{}' on line {}.", treeBuilder, lineNum));
+
+            treeBuilderFound = true;
+        }
+        else if (parameter == "TREEREBUILDINTERVAL")
+            READ_PARAMETER("TREEREBUILDINTERVAL", treeRebuildIntervalFound, g_treeRebuildInterval);
+        else if (parameter == "TREEREFITMAXGROWTH")
+            READ_PARAMETER("TREEREFITMAXGROWTH", treeRefitMaxGrowthFound, g_treeRefitMaxGrowth);
+        else if (parameter == "LEAFSIZE")
+            READ_PARAMETER("LEAFSIZE", leafSizeFound, g_leafSize);
+        else if (parameter == "FORCETRAVERSAL")
+        {
+            if (forceTraversalFound)
+                throw std::runtime_error(std::format("Double definition of FORCETRAVERSAL on line {}.", lineNum));
+
+            std::string forceTraversal;
+            ss >> forceTraversal;
+
+            if (forceTraversal == "BODY")
+                g_forceTraversal = ForceTraversal::Body;
+            else if (forceTraversal == "GROUP")
+                g_forceTraversal = ForceTraversal::Group;
+            else
+                throw std::runtime_error(std::format("Unknown force traversal '{}' on line {}.", forceTraversal,
+                    lineNum));
+
+            forceTraversalFound = true;
+        }
+        else if (parameter == "GROUPSIZE")
+            READ_PARAMETER("GROUPSIZE", groupSizeFound, g_groupSize);
+        else if (parameter == "SOLVER")
+        {
+            if (solverFound)
+                throw std::runtime_error(std::format("Double definition of SOLVER on line {}.", lineNum));
+
+            std::string solver;
+            ss >> solver;
+
+            if (solver == "BARNESHUT")
+                g_solver = Solver::BarnesHut;
+            else if (solver == "FMM")
+                g_solver = Solver::FMM;
+            else if (solver == "DIRECT")
+                g_solver = Solver::Direct;
+            else
+                throw std::runtime_error(std::format("Unknown solver '{}' on line {}.", solver, lineNum));
+
+            solverFound = true;
+        }
+        else if (parameter == "FMMORDER")
+            READ_PARAMETER("FMMORDER", fmmOrderFound, g_fmmOrder);
+        else if (parameter == "FMMTHETA")
+            READ_PARAMETER("FMMTHETA", fmmThetaFound, g_fmmTheta);
+        else if (parameter == "REORDERBODIES")
+            READ_PARAMETER("REORDERBODIES", reorderBodiesFound, g_reorderBodies);
+        else if (parameter == "PRECISION")
+        {
+            if (precisionFound)
+                throw std::runtime_error(std::format("Double definition of PRECISION on line {}.", lineNum));
+
+            std::string precision;
+            ss >> precision;
+
+            if (precision == "FLOAT")
+                g_precision = Precision::Float;
+            else if (precision == "DOUBLE")
+                g_precision = Precision::Double;
+            else if (precision == "MIXED")
+                g_precision = Precision::Mixed;
+            else
+                throw std::runtime_error(std::format("Unknown precision '{}' on line {}.", precision, lineNum));
+
+            precisionFound = true;
+        }
+        else if (parameter == "BLOCKTIMESTEPLEVELS")
+            READ_PARAMETER("BLOCKTIMESTEPLEVELS", blockTimestepLevelsFound, g_blockTimestepLevels);
+        else if (parameter == "BLOCKTIMESTEPTOLERANCE")
+            READ_PARAMETER("BLOCKTIMESTEPTOLERANCE", blockTimestepToleranceFound, g_blockTimestepTolerance);
+        else if (parameter == "INTEGRATOR")
+        {
+            if (integratorFound)
+                throw std::runtime_error(std::format("Double definition of INTEGRATOR on line {}.", lineNum));
+
+            std::string integrator;
+            ss >> integrator;
+
+            if (integrator == "LEAPFROG")
+                g_integrator = Integrator::Leapfrog;
+            else if (integrator == "FORESTRUTH")
+                g_integrator = Integrator::ForestRuth;
+            else
+                throw std::runtime_error(std::format("Unknown integrator '{}' on line {}.", integrator, lineNum));
+
+            integratorFound = true;
+        }
+        else if (parameter == "DIRECTSUMMAXBODIES")
+            READ_PARAMETER("DIRECTSUMMAXBODIES", directSumMaxBodiesFound, g_directSumMaxBodies);
+        else if (parameter == "TRAJECTORYINTERVAL")
+            READ_PARAMETER("TRAJECTORYINTERVAL", trajectoryIntervalFound, g_trajectoryInterval);
+        else if (parameter == "TRAJECTORYENCODING")
+        {
+            if (trajectoryEncodingFound)
+                throw std::runtime_error(std::format("Double definition of TRAJECTORYENCODING on line {}.", lineNum));
+
+            std::string trajectoryEncoding;
+            ss >> trajectoryEncoding;
+
+            if (trajectoryEncoding == "RAW")
+                g_trajectoryEncoding = TrajectoryEncoding::Raw;
+            else if (trajectoryEncoding == "QUANTIZED")
+                g_trajectoryEncoding = TrajectoryEncoding::Quantized;
+            else if (trajectoryEncoding == "DELTA")
+                g_trajectoryEncoding = TrajectoryEncoding::Delta;
+            else
+                throw std::runtime_error(std::format("Unknown trajectory encoding '{}' on line {}.", trajectoryEncoding,
+                    lineNum));
+
+            trajectoryEncodingFound = true;
+        }
+        else if (parameter == "TRAJECTORYQUANTUM")
+            READ_PARAMETER("TRAJECTORYQUANTUM", trajectoryQuantumFound, g_trajectoryQuantum);
+        else if (parameter == "TRAJECTORYBUFFERS")
+            READ_PARAMETER("TRAJECTORYBUFFERS", trajectoryBuffersFound, g_trajectoryBuffers);
+        else if (parameter == "TRAJECTORYBACKPRESSURE")
+        {
+            if (trajectoryBackpressureFound)
+                throw std::runtime_error(std::format("Double definition of TRAJECTORYBACKPRESSURE on line {}.",
+                    lineNum));
+
+            std::string trajectoryBackpressure;
+            ss >> trajectoryBackpressure;
+
+            if (trajectoryBackpressure == "BLOCK")
+                g_trajectoryBackpressure = TrajectoryBackpressure::Block;
+            else if (trajectoryBackpressure == "DROP")
+                g_trajectoryBackpressure = TrajectoryBackpressure::Drop;
+            else
+                throw std::runtime_error(std::format("Unknown trajectory backpressure '{}' on line {}.",
+                    trajectoryBackpressure, lineNum));
+
+            trajectoryBackpressureFound = true;
+        }
         else
             throw std::runtime_error(std::format("Unknown parameter '{}' on line {}.", parameter, lineNum));
 #undef READ_PARAMETER
@@ -147,7 +427,12 @@ void loadSimulationFile(const char* simulationPath)
     }
 
     if (!(thetaFound && gravConstFound && gravSmoothnessFound && screenDimsFound && targetFPSFound && timeScaleFound &&
-        bodyColorFound && colormapModeFound && colormapMaxSpeedFound))
+        bodyColorFound && colormapModeFound && colormapMaxSpeedFound && treeBuilderFound &&
+        treeRebuildIntervalFound && treeRefitMaxGrowthFound && leafSizeFound &&
+        forceTraversalFound && groupSizeFound && solverFound && fmmOrderFound && fmmThetaFound &&
+        reorderBodiesFound && precisionFound && blockTimestepLevelsFound && blockTimestepToleranceFound &&
+        integratorFound && directSumMaxBodiesFound && trajectoryIntervalFound && trajectoryEncodingFound &&
+        trajectoryQuantumFound && trajectoryBuffersFound && trajectoryBackpressureFound))
         throw std::runtime_error(std::format("Did not find a definition for every parameter.\n"
             "\tTHETA: {}\n"
             "\tGRAVCONST: {}\n"
@@ -158,7 +443,27 @@ void loadSimulationFile(const char* simulationPath)
             "\tBODYCOLOR: {}\n"
             "\tBODYALPHA: {}\n"
             "\tUSECOLORMAP: {}\n"
-            "\tCOLORMAPMAXSPEED: {}\n",
+            "\tCOLORMAPMAXSPEED: {}\n"
+            "\tTREEBUILDER: {}\n"
+            "\tTREEREBUILDINTERVAL: {}\n"
+            "\tTREEREFITMAXGROWTH: {}\n"
+            "\tLEAFSIZE: {}\n"
+            "\tFORCETRAVERSAL: {}\n"
+            "\tGROUPSIZE: {}\n"
+            "\tSOLVER: {}\n"
+            "\tFMMORDER: {}\n"
+            "\tFMMTHETA: {}\n"
+            "\tREORDERBODIES: {}\n"
+            "\tPRECISION: {}\n"
+            "\tBLOCKTIMESTEPLEVELS: {}\n"
+            "\tBLOCKTIMESTEPTOLERANCE: {}\n"
+            "\tINTEGRATOR: {}\n"
+            "\tDIRECTSUMMAXBODIES: {}\n"
+            "\tTRAJECTORYINTERVAL: {}\n"
+            "\tTRAJECTORYENCODING: {}\n"
+            "\tTRAJECTORYQUANTUM: {}\n"
+            "\tTRAJECTORYBUFFERS: {}\n"
+            "\tTRAJECTORYBACKPRESSURE: {}\n",
             thetaFound ? "found" : "missing",
             gravConstFound ? "found" : "missing",
             gravSmoothnessFound ? "found" : "missing",
@@ -168,8 +473,131 @@ void loadSimulationFile(const char* simulationPath)
             bodyColorFound ? "found" : "missing",
             bodyAlphaFound ? "found" : "missing",
             colormapModeFound ? "found" : "missing",
-            colormapMaxSpeedFound ? "found" : "missing"));
+            colormapMaxSpeedFound ? "found" : "missing",
+            treeBuilderFound ? "found" : "missing",
+            treeRebuildIntervalFound ? "found" : "missing",
+            treeRefitMaxGrowthFound ? "found" : "missing",
+            leafSizeFound ? "found" : "missing",
+            forceTraversalFound ? "found" : "missing",
+            groupSizeFound ? "found" : "missing",
+            solverFound ? "found" : "missing",
+            fmmOrderFound ? "found" : "missing",
+            fmmThetaFound ? "found" : "missing",
+            reorderBodiesFound ? "found" : "missing",
+            precisionFound ? "found" : "missing",
+            blockTimestepLevelsFound ? "found" : "missing",
+            blockTimestepToleranceFound ? "found" : "missing",
+            integratorFound ? "found" : "missing",
+            directSumMaxBodiesFound ? "found" : "missing",
+            trajectoryIntervalFound ? "found" : "missing",
+            trajectoryEncodingFound ? "found" : "missing",
+            trajectoryQuantumFound ? "found" : "missing",
+            trajectoryBuffersFound ? "found" : "missing",
+            trajectoryBackpressureFound ? "found" : "missing"));
 
     g_deltaTime = g_timeScale / static_cast<float>(g_targetFPS);
     g_colormapMaxSqrSpeed = g_colormapMaxSpeed * g_colormapMaxSpeed;
+
+    if (g_treeRebuildInterval < 1)
+        throw std::runtime_error("TREEREBUILDINTERVAL must be at least 1.");
+    if (g_leafSize < 1)
+        throw std::runtime_error("LEAFSIZE must be at least 1.");
+    if (g_groupSize < 1)
+        throw std::runtime_error("GROUPSIZE must be at least 1.");
+    if (g_fmmOrder < 1 || g_fmmOrder > MAX_FMM_ORDER)
+        throw std::runtime_error(std::format("FMMORDER must be between 1 and {}.", MAX_FMM_ORDER));
+    if (g_fmmTheta < 0 || g_fmmTheta >= 1)
+        throw std::runtime_error("FMMTHETA must be at least 0 and less than 1.");
+    if (g_directSumMaxBodies < 0)
+        throw std::runtime_error("DIRECTSUMMAXBODIES must not be negative.");
+    if (g_blockTimestepLevels < 1 || g_blockTimestepLevels > MAX_BLOCK_TIMESTEP_LEVELS)
+        throw std::runtime_error(std::format("BLOCKTIMESTEPLEVELS must be between 1 and {}.",
+            MAX_BLOCK_TIMESTEP_LEVELS));
+    if (g_blockTimestepTolerance <= 0)
+        throw std::runtime_error("BLOCKTIMESTEPTOLERANCE must be positive.");
+    if (g_blockTimestepLevels > 1 && g_integrator != Integrator::Leapfrog)
+        throw std::runtime_error("BLOCKTIMESTEPLEVELS must be 1 unless INTEGRATOR is LEAPFROG.");
+    if (g_trajectoryInterval < 1)
+        throw std::runtime_error("TRAJECTORYINTERVAL must be at least 1.");
+    if (g_trajectoryQuantum <= 0)
+        throw std::runtime_error("TRAJECTORYQUANTUM must be positive.");
+    if (g_trajectoryBuffers < 1)
+        throw std::runtime_error("TRAJECTORYBUFFERS must be at least 1.");
+}
+
+// Config file names of each enum's values, indexed by value.
+static constexpr const char* COLORMAP_MODE_PARAMETERS[] = {"NONE", "SPEED", "VELOCITY"};
+static constexpr const char* TREE_BUILDER_PARAMETERS[] = {"PARTITION", "MORTON"};
+static constexpr const char* FORCE_TRAVERSAL_PARAMETERS[] = {"BODY", "GROUP"};
+static constexpr const char* SOLVER_PARAMETERS[] = {"BARNESHUT", "FMM", "DIRECT"};
+static constexpr const char* PRECISION_PARAMETERS[] = {"FLOAT", "DOUBLE", "MIXED"};
+static constexpr const char* INTEGRATOR_PARAMETERS[] = {"LEAPFROG", "FORESTRUTH"};
+static constexpr const char* TRAJECTORY_ENCODING_PARAMETERS[] = {"RAW", "QUANTIZED", "DELTA"};
+static constexpr const char* TRAJECTORY_BACKPRESSURE_PARAMETERS[] = {"BLOCK", "DROP"};
+
+std::string simulationParametersToString()
+{
+    return std::format(
+        "THETA {}\n"
+        "GRAVCONST {}\n"
+        "GRAVSMOOTHNESS {}\n"
+        "SCREENDIMS {} {}\n"
+        "RESIZABLE {}\n"
+        "TARGETFPS {}\n"
+        "TIMESCALE {}\n"
+        "BODYCOLOR {} {} {}\n"
+        "BODYALPHA {}\n"
+        "COLORMAPMODE {}\n"
+        "COLORMAPMAXSPEED {}\n"
+        "TREEBUILDER {}\n"
+        "TREEREBUILDINTERVAL {}\n"
+        "TREEREFITMAXGROWTH {}\n"
+        "LEAFSIZE {}\n"
+        "FORCETRAVERSAL {}\n"
+        "GROUPSIZE {}\n"
+        "SOLVER {}\n"
+        "FMMORDER {}\n"
+        "FMMTHETA {}\n"
+        "DIRECTSUMMAXBODIES {}\n"
+        "REORDERBODIES {}\n"
+        "PRECISION {}\n"
+        "BLOCKTIMESTEPLEVELS {}\n"
+        "BLOCKTIMESTEPTOLERANCE {}\n"
+        "INTEGRATOR {}\n"
+        "TRAJECTORYINTERVAL {}\n"
+        "TRAJECTORYENCODING {}\n"
+        "TRAJECTORYQUANTUM {}\n"
+        "TRAJECTORYBUFFERS {}\n"
+        "TRAJECTORYBACKPRESSURE {}\n",
+        g_theta,
+        g_gravConst,
+        g_gravSmoothness,
+        g_screenDims.x, g_screenDims.y,
+        static_cast<int>(g_resizable),
+        g_targetFPS,
+        g_timeScale,
+        static_cast<int>(g_bodyColor.r), static_cast<int>(g_bodyColor.g), static_cast<int>(g_bodyColor.b),
+        g_bodyAlpha,
+        COLORMAP_MODE_PARAMETERS[static_cast<int>(g_colormapMode)],
+        g_colormapMaxSpeed,
+        TREE_BUILDER_PARAMETERS[static_cast<int>(g_treeBuilder)],
+        g_treeRebuildInterval,
+        g_treeRefitMaxGrowth,
+        g_leafSize,
+        FORCE_TRAVERSAL_PARAMETERS[static_cast<int>(g_forceTraversal)],
+        g_groupSize,
+        SOLVER_PARAMETERS[static_cast<int>(g_solver)],
+        g_fmmOrder,
+        g_fmmTheta,
+        g_directSumMaxBodies,
+        static_cast<int>(g_reorderBodies),
+        PRECISION_PARAMETERS[static_cast<int>(g_precision)],
+        g_blockTimestepLevels,
+        g_blockTimestepTolerance,
+        INTEGRATOR_PARAMETERS[static_cast<int>(g_integrator)],
+        g_trajectoryInterval,
+        TRAJECTORY_ENCODING_PARAMETERS[static_cast<int>(g_trajectoryEncoding)],
+        g_trajectoryQuantum,
+        g_trajectoryBuffers,
+        TRAJECTORY_BACKPRESSURE_PARAMETERS[static_cast<int>(g_trajectoryBackpressure)]);
 }